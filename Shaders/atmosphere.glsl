@@ -0,0 +1,98 @@
+// Planet and atmosphere shared by the sky in default.frag and the LUT bakes (transmittanceLUT.comb, skyView.comb).
+// The sky is precomputed into two lookup tables:
+//   transmittance LUT: optical depth from a point towards the atmosphere edge, over (cos zenith angle, height)
+//   sky-view LUT:      in-scattered light (rgb) and optical depth (a) of a view ray, over (azimuth, elevation)
+
+#define SUN_RADIUS 100.f
+
+#define PLANET_RADIUS 1000.f
+#define ATMOS_RADIUS 1050.f
+#define PLANET_CENTER vec3(0.f, -PLANET_RADIUS, 0.f)
+#define NUM_IN_SCATTERING_POINTS 10
+#ifndef HALF_PI
+#define HALF_PI 1.57079632679
+#endif
+#define TWO_PI 6.28318530718
+
+vec3 dirSph2Cart(float latitudeRadians, float longitudeRadians) {
+    float x, y, z;
+    x = sin(longitudeRadians) * sin(latitudeRadians);
+    y = cos(longitudeRadians);
+    z = sin(longitudeRadians) * cos(latitudeRadians);
+    return vec3(x, y, z);
+}
+
+// Rayleigh-like scattering coefficients for RGB
+vec3 scatteringCoefficients() {
+    float scatteringStrength = 0.09;
+    vec3 wavelengths = vec3(700, 530, 440);
+    float scatterR = pow(400 / wavelengths[0], 4) * scatteringStrength;
+    float scatterG = pow(400 / wavelengths[1], 4) * scatteringStrength;
+    float scatterB = pow(400 / wavelengths[2], 4) * scatteringStrength;
+    return vec3(scatterR, scatterG, scatterB);
+}
+
+//------------Skycolor-------------------------------------------------------------------
+// Simulates an atmosphere
+// return the distance traveled inside the atmosphere
+float raySphere(vec3 sphereCenter, float sphereRadius, vec3 rayOrigin, vec3 rayDir) {
+    vec3 offset = rayOrigin - sphereCenter;
+    float a = 1;
+    float b = 2 * dot(offset, rayDir);
+    float c = dot(offset, offset) - sphereRadius * sphereRadius;
+    float d = b*b - 4*a*c;
+
+    if (d >= 0) {
+        float s = sqrt(d);
+        float dstNear = max(0, (-b-s)/(2*a));
+        float dstFar = (-b+s)/(2*a);
+        if (dstFar >= 0) {
+            return dstFar - dstNear;
+        }
+    }
+    return 0.0;
+}
+
+// Used for sky scattering, simulates the particle density in the atmosphere
+float densityAtPoint(vec3 pointPosWorld, vec3 planetCenter, float planetRadius, float atmosRadius) {
+    float densityFalloff = 4.0;
+    float height = length(pointPosWorld - planetCenter) - planetRadius;
+    float height01 = height / (atmosRadius - planetRadius);
+    float density = exp(- height01 * densityFalloff) * (1 - height01);
+    return density;
+}
+
+// optical depth: average density along the ray, determined by the raylength (from point to the sun, within the atmosphere)
+float opticalDepth(vec3 rayOrig, vec3 rayDir, float rayLength, vec3 planetCenter, float planetRadius, float atmosRadius) {
+    int numOpticalPoints = 10;
+    vec3 densitySamplePoint = rayOrig;
+    float stepSize = rayLength / (numOpticalPoints - 1);
+    float opticalDepth = 0;
+    for (int i = 0; i < numOpticalPoints; i++) {
+        float localDensity = densityAtPoint(densitySamplePoint, planetCenter, planetRadius, atmosRadius);
+        opticalDepth += localDensity * stepSize;
+        densitySamplePoint += rayDir * stepSize;
+    }
+    return opticalDepth;
+}
+
+// Transmittance LUT parameterization: u = cos of the angle to the local up vector, v = height in the atmosphere
+vec2 transmittanceUV(float cosZenith, float height) {
+    return vec2(cosZenith * .5f + .5f, height / (ATMOS_RADIUS - PLANET_RADIUS));
+}
+
+// Sky-view LUT parameterization: u = azimuth, v = elevation, with more texels near the horizon
+// where the sky changes fastest
+vec2 skyViewUV(vec3 rayDir) {
+    float azimuth = atan(rayDir.z, rayDir.x);
+    float elevation = asin(clamp(rayDir.y, -1.f, 1.f));
+    float v = .5f + .5f * sign(elevation) * sqrt(abs(elevation) / HALF_PI);
+    return vec2(azimuth / TWO_PI + .5f, v);
+}
+
+vec3 skyViewDirection(vec2 uv) {
+    float azimuth = (uv.x - .5f) * TWO_PI;
+    float l = 2.f * uv.y - 1.f;
+    float elevation = sign(l) * l * l * HALF_PI;
+    return vec3(cos(elevation) * cos(azimuth), sin(elevation), cos(elevation) * sin(azimuth));
+}
@@ -0,0 +1,82 @@
+#version 460 core
+
+// Upsamples the reduced-resolution output of default.frag onto the full-resolution terrain.
+// Each pixel blends the four nearest low-res texels with bilinear weights, scaled down for texels
+// whose terrain depth differs from the pixel's own (joint bilateral filter guided by the FBO depth),
+// so clouds and sky do not bleed across mountain silhouettes.
+
+#define DEPTH_SIGMA 0.05f  // relative depth difference at which a texel's weight drops to 1/e
+#define MIN_TOTAL_WEIGHT 1e-4f
+
+in vec2 uv;
+out vec4 glFragColor;
+
+uniform sampler2D cloudColor;  // terrain pixels: (cloud light, transmittance), sky pixels: (color, 0)
+uniform sampler2D solidDepth;  // full resolution
+uniform sampler2D solidColor;
+
+uniform float near, far;  // terrain camera
+
+#include "renderParams.glsl"  // gammaCorrect
+
+
+float linearizeDepth(float depth) {
+    float z = depth * 2.0 - 1.0; // Back to NDC, [0, 1] -> [-1, 1]
+    return (2.0 * near * far) / (far + near - z * (far - near));  // Linearize z, [-1, 1] -> [near, far]
+}
+
+float linear2srgb(float x) {
+    if (x <= 0.0031308f)
+        return 12.92f * x;
+    return 1.055f * pow(x, 1.f / 2.4f) - 0.055f;
+}
+
+vec3 gammaCorrection(vec3 linearRGB) {
+    return vec3(linear2srgb(linearRGB.r), linear2srgb(linearRGB.g), linear2srgb(linearRGB.b));
+}
+
+
+void main() {
+    const float rawDepth = texelFetch(solidDepth, ivec2(gl_FragCoord.xy), 0).r;
+    const bool hitSolid = rawDepth < 1;
+    const float depth = linearizeDepth(rawDepth);
+
+    const ivec2 lowResSize = textureSize(cloudColor, 0);
+    const vec2 lowResPosition = uv * vec2(lowResSize) - .5f;
+    const ivec2 base = ivec2(floor(lowResPosition));
+    const vec2 f = lowResPosition - vec2(base);
+
+    vec4 sum = vec4(0.f);
+    float totalWeight = 0.f;
+    vec4 closest = vec4(0.f);  // fallback when no texel is at this pixel's depth
+    float closestDiff = 1e30f;
+    for (int y = 0; y <= 1; y++) {
+        for (int x = 0; x <= 1; x++) {
+            const ivec2 texel = clamp(base + ivec2(x, y), ivec2(0), lowResSize - 1);
+            const vec4 value = texelFetch(cloudColor, texel, 0);
+            // the depth default.frag saw when shading this texel
+            const float texelDepth = linearizeDepth(texture(solidDepth, (vec2(texel) + .5f) / vec2(lowResSize)).r);
+            const float depthDiff = abs(texelDepth - depth) / depth;
+
+            const float bilinear = (x == 1 ? f.x : 1.f - f.x) * (y == 1 ? f.y : 1.f - f.y);
+            const float weight = bilinear * exp(-depthDiff / DEPTH_SIGMA);
+            sum += weight * value;
+            totalWeight += weight;
+            if (depthDiff < closestDiff) {
+                closestDiff = depthDiff;
+                closest = value;
+            }
+        }
+    }
+    // A thin sliver of terrain missed by every texel shows through without clouds
+    const vec4 fallback = hitSolid ? vec4(0.f, 0.f, 0.f, 1.f) : closest;
+    const vec4 clouds = totalWeight > MIN_TOTAL_WEIGHT ? sum / totalWeight : fallback;
+
+    vec3 color = clouds.rgb;
+    if (hitSolid)  // terrain behind the clouds
+        color = min(color + clouds.a * texelFetch(solidColor, ivec2(gl_FragCoord.xy), 0).rgb, 1.f);
+
+    if (gammaCorrect)
+        color = gammaCorrection(color);
+    glFragColor = vec4(color, 1.f);
+}
@@ -0,0 +1,202 @@
+// Cloud density shared by the ray marcher (default.frag) and the light-volume bake (lightVolume.comb).
+// Include after #version; the storage-format defines (VOLUME_UNORM, VOLUME_SPLIT_CHANNELS) and the feature flags
+// (INVERT_DENSITY, EROSION_CUBIC, MAX_DENSITY_LOD) are injected by the application.
+
+#define XZ_FALLOFF_DIST 1.f
+#define Y_FALLOFF_DIST 1.f
+// coarsest mip of the density volumes sampleDensity reads (Settings::densityMaxLod), 0: full resolution only
+#ifndef MAX_DENSITY_LOD
+#define MAX_DENSITY_LOD 0
+#endif
+
+// density volumes computed by the compute shader, with a tileable mip chain (volumeMip.comb)
+uniform sampler3D volumeHighRes;
+uniform sampler3D volumeLowRes;
+#ifdef VOLUME_SPLIT_CHANNELS
+// RGBA channels stored as separate single-channel textures, so each fetch only reads one byte
+uniform sampler3D volumeHighResChannels[4];
+uniform sampler3D volumeLowResChannels[4];
+#endif
+
+// volume transforms, density and noise params, updated when user changes settings
+#include "renderParams.glsl"
+
+// normalized v so that dot(v, 1) = 1
+vec4 normalizeL1(vec4 v) {
+    return v / dot(v, vec4(1.f));
+}
+
+// fast AABB intersection
+vec2 intersectBox(vec3 orig, vec3 dir) {
+    vec3 boxMin = -.5f * volumeScaling + volumeTranslate;
+    vec3 boxMax = +.5f * volumeScaling + volumeTranslate;
+    vec3 invDir = 1.0 / dir;
+    vec3 tmin_tmp = (boxMin - orig) * invDir;
+    vec3 tmax_tmp = (boxMax - orig) * invDir;
+    vec3 tmin = min(tmin_tmp, tmax_tmp);
+    vec3 tmax = max(tmin_tmp, tmax_tmp);
+    float tn = max(tmin.x, max(tmin.y, tmin.z));
+    float tf = min(tmax.x, min(tmax.y, tmax.z));
+    return vec2(tn, tf);
+}
+
+// world-space position -> [0, 1]^3 texture coordinates over the cloud box
+vec3 boxUVW(vec3 position) {
+    return (position - volumeTranslate) / volumeScaling + .5f;
+}
+
+float getErosionWeightQuntic(float density) {
+    return pow( (1.f - density), 6 ) ;
+}
+
+float getErosionWeightCubic(float density) {
+    return (1.f - density) * (1.f - density) * (1.f - density);
+}
+
+float yFalloff(vec3 position) {
+    float ymin = -.5f * volumeScaling.y + volumeTranslate.y;
+    float ymax = ymin + volumeScaling.y;
+    float distY = min(Y_FALLOFF_DIST, min(position.y - ymin, ymax - position.y));
+    return distY / Y_FALLOFF_DIST;
+}
+
+float xzFalloff(vec3 position) {
+    float xmin = -.5f * volumeScaling.x + volumeTranslate.x;
+    float xmax = xmin + volumeScaling.x;
+    float zmin = -.5f * volumeScaling.z + volumeTranslate.z;
+    float zmax = zmin + volumeScaling.z;
+    float distX = min(XZ_FALLOFF_DIST, min(position.x - xmin, xmax - position.x));
+    float distZ = min(XZ_FALLOFF_DIST, min(position.z - zmin, zmax - position.z));
+    return min(distX, distZ) / XZ_FALLOFF_DIST;
+}
+
+vec4 decodeDensity(vec4 texel) {
+#ifdef VOLUME_UNORM
+    return unormDensityRange.x + texel * (unormDensityRange.y - unormDensityRange.x);
+#else
+    return texel;
+#endif
+}
+
+int hiResResolution() {
+#ifdef VOLUME_SPLIT_CHANNELS
+    return textureSize(volumeHighResChannels[0], 0).x;
+#else
+    return textureSize(volumeHighRes, 0).x;
+#endif
+}
+
+int loResResolution() {
+#ifdef VOLUME_SPLIT_CHANNELS
+    return textureSize(volumeLowResChannels[0], 0).x;
+#else
+    return textureSize(volumeLowRes, 0).x;
+#endif
+}
+
+// Mip level whose texels are footprint wide in world space, for a volume sampled at position * scale
+float densityLod(float footprint, float scale, int resolution) {
+    return clamp(log2(max(footprint * abs(scale) * float(resolution), 1e-20f)), 0.f, float(MAX_DENSITY_LOD));
+}
+
+// Density at position, filtered over footprint: the world-space size of the region the sample stands for
+// (pixel cone width and step length), which picks the mip level of each volume, 0 for full resolution
+float sampleDensity(vec3 position, float footprint) {
+    // Sample high-res shape textures
+
+     vec3 hiResT = .1f * hiResNoiseTranslate;
+     vec4 hiResS = .1f * hiResNoiseScaling;
+
+     mat4x3 hiResPosition = outerProduct(position, hiResS) + outerProduct(hiResT, vec4(1.f));
+     const int hiResRes = hiResResolution();
+     vec4 hiResLod;
+     for (int channel = 0; channel < 4; channel++)
+         hiResLod[channel] = densityLod(footprint, hiResS[channel], hiResRes);
+
+#ifdef VOLUME_SPLIT_CHANNELS
+     vec4 hiResNoise = vec4(
+                textureLod(volumeHighResChannels[0], hiResPosition[0], hiResLod[0]).r,
+                textureLod(volumeHighResChannels[1], hiResPosition[1], hiResLod[1]).r,
+                textureLod(volumeHighResChannels[2], hiResPosition[2], hiResLod[2]).r,
+                textureLod(volumeHighResChannels[3], hiResPosition[3], hiResLod[3]).r
+                );
+#else
+     vec4 hiResNoise = vec4(
+                textureLod(volumeHighRes, hiResPosition[0], hiResLod[0]).r,
+                textureLod(volumeHighRes, hiResPosition[1], hiResLod[1]).g,
+                textureLod(volumeHighRes, hiResPosition[2], hiResLod[2]).b,
+                textureLod(volumeHighRes, hiResPosition[3], hiResLod[3]).a
+                );
+#endif
+     hiResNoise = decodeDensity(hiResNoise);
+    float hiResDensity = dot( hiResNoise, normalizeL1(hiResChannelWeights) );
+#ifdef INVERT_DENSITY
+    hiResDensity = 1.f - hiResDensity;
+#endif
+
+    // Reduce density at the bottom of the cloud to create crisp shape
+    float falloff = yFalloff(position) * xzFalloff(position);
+    hiResDensity *= falloff;
+
+    // Control the cover of clouds by offsetting density
+    float hiResDensityWithOffset = hiResDensity + hiResDensityOffset;
+
+    // Skip adding details if there is no cloud to begin with
+    if (hiResDensityWithOffset <= 0.f)
+        return 0.f;
+
+    // Sample low-res detail textures
+     vec3 loResPosition = position * loResNoiseScaling * .1f + loResNoiseTranslate;
+     float loResLod = densityLod(footprint, loResNoiseScaling * .1f, loResResolution());
+#ifdef VOLUME_SPLIT_CHANNELS
+     vec4 loResNoise = vec4(
+                textureLod(volumeLowResChannels[0], loResPosition, loResLod).r,
+                textureLod(volumeLowResChannels[1], loResPosition, loResLod).r,
+                textureLod(volumeLowResChannels[2], loResPosition, loResLod).r,
+                textureLod(volumeLowResChannels[3], loResPosition, loResLod).r
+                );
+#else
+     vec4 loResNoise = textureLod(volumeLowRes, loResPosition, loResLod);
+#endif
+     loResNoise = decodeDensity(loResNoise);
+    float loResDensity = dot( loResNoise, normalizeL1(loResChannelWeights) );
+    loResDensity = 1.f - loResDensity;  // invert the low-res density by default
+
+    // Detail erosion: subtract low-res detail from hi-res noise, weighted as such that
+    // the erosion is more pronounced near the boudary of the cloud (low hiResDensity)
+#ifdef EROSION_CUBIC
+     float erosionWeight = getErosionWeightCubic(hiResDensity);
+#else
+     float erosionWeight = getErosionWeightQuntic(hiResDensity);
+#endif
+
+     float density = hiResDensityWithOffset - erosionWeight*loResDensityWeight * loResDensity;
+    return max(density * densityMult*5.f, 0.f);
+}
+
+// Full-resolution density, for the light rays
+float sampleDensity(vec3 position) {
+    return sampleDensity(position, 0.f);
+}
+
+// One-bounce raymarch to get light transmittance
+float computeLightTransmittance(vec3 rayOrig, vec3 rayDir) {
+     int numStepsRecursive = numSteps / 8;
+     vec2 tHit = intersectBox(rayOrig, rayDir);
+     float tFar = max(0.f, tHit.y);
+     float dt = tFar / numStepsRecursive;
+     vec3 ds = rayDir * dt;
+
+    float tau = 0.f;  // log transmittance
+    vec3 pointWorld = rayOrig;
+    for (float t = 0.f; t < tFar; t += dt) {
+         float density = sampleDensity(pointWorld);
+        tau -= density;
+        pointWorld += ds;
+    }
+    tau *= (cloudLightAbsorptionMult * dt);  // delay multiplication to save compute and avoid precision issues
+    float lightTransmittance = exp(tau);
+
+    // ambient hack to make clouds less dark
+    return minLightTransmittance + lightTransmittance * (1.f - minLightTransmittance);
+}
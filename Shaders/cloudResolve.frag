@@ -0,0 +1,57 @@
+#version 460 core
+
+// Rebuilds the full-resolution cloud buffer from this frame's checkerboard samples (default.frag
+// compiled with CLOUD_MARCH_PASS) and last frame's result. The pixel marched this frame takes its
+// fresh sample; every other pixel is reprojected into the history through last frame's projView
+// and clamped to the fresh samples around it, so history that no longer matches is rejected.
+
+in vec2 uv;
+in vec3 rayDirWorldspace;
+layout(location = 0) out vec4 resolvedCloud;  // rgb: light scattered by the clouds, a: transmittance
+
+uniform sampler2D cloudSamples;      // 1/checkerSize resolution, one marched pixel per block
+uniform sampler2D cloudSampleDepth;  // distance along the ray of each sample
+uniform sampler2D cloudHistory;      // last frame's resolved buffer
+uniform bool historyValid;           // false on the first frame and after anything invalidated it
+
+uniform int checkerSize;
+uniform ivec2 checkerOffset;  // pixel of each block marched this frame
+
+uniform vec3 rayOrigWorld;
+uniform mat4 prevProjView;  // Camera::getProjView() of the frame the history was rendered with
+
+
+void main() {
+    const ivec2 pixel = ivec2(gl_FragCoord.xy);
+    const ivec2 block = pixel / checkerSize;
+    const ivec2 lastBlock = textureSize(cloudSamples, 0) - 1;
+    const vec4 fresh = texelFetch(cloudSamples, block, 0);
+
+    if (!historyValid || pixel - block * checkerSize == checkerOffset) {
+        resolvedCloud = fresh;
+        return;
+    }
+
+    // Range of this frame's samples around the pixel, the history has to fall inside it
+    vec4 neighbourMin = fresh;
+    vec4 neighbourMax = fresh;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            const vec4 neighbour = texelFetch(cloudSamples, clamp(block + ivec2(x, y), ivec2(0), lastBlock), 0);
+            neighbourMin = min(neighbourMin, neighbour);
+            neighbourMax = max(neighbourMax, neighbour);
+        }
+    }
+
+    // Where the cloud seen through this pixel was on screen last frame
+    const float depth = texelFetch(cloudSampleDepth, block, 0).r;
+    const vec3 pointWorld = rayOrigWorld + depth * normalize(rayDirWorldspace);
+    const vec4 prevClip = prevProjView * vec4(pointWorld, 1.f);
+    const vec2 prevUV = prevClip.xy / prevClip.w * .5f + .5f;
+    if (prevClip.w <= 0.f || any(lessThan(prevUV, vec2(0.f))) || any(greaterThan(prevUV, vec2(1.f)))) {
+        resolvedCloud = fresh;  // disoccluded from outside the screen
+        return;
+    }
+
+    resolvedCloud = clamp(texture(cloudHistory, prevUV), neighbourMin, neighbourMax);
+}
@@ -0,0 +1,31 @@
+/* GLSL port of src/noise/counterrng.h (Philox4x32-10), bit for bit the same values as the CPU,
+ * so a cell's random point can be computed in the shader that needs it instead of uploaded.
+ * The 64-bit seed is passed as uvec2(low word, high word).
+ */
+
+// Stream ids, same as CounterRNG::Stream
+#define RNG_WORLEY_POINTS_3D 1u
+
+uvec4 philox4x32(uvec4 counter, uvec2 seed) {
+    const uint M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+    const uint W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+    uvec2 key = seed;
+    for (int round = 0; round < 10; round++) {
+        uint hi0, lo0, hi1, lo1;
+        umulExtended(M0, counter.x, hi0, lo0);
+        umulExtended(M1, counter.z, hi1, lo1);
+        counter = uvec4(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+        key += uvec2(W0, W1);
+    }
+    return counter;
+}
+
+uint rngSubStream(uint stream, uint index) { return stream | index << 8; }
+
+// Four independent values for integer cell of a stream, see CounterRNG::cell
+uvec4 rngCell(uint stream, ivec3 cell, uvec2 seed) {
+    return philox4x32(uvec4(uvec3(cell), stream), seed);
+}
+
+// Top 24 bits to a float in [0, 1), see CounterRNG::toUnitFloat
+vec4 rngToUnitFloat(uvec4 bits) { return vec4(bits >> 8u) * (1.f / 16777216.f); }
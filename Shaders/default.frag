@@ -4,22 +4,26 @@
 #define EARLY_STOP_LOG_THRESHOLD -4.6f
 #define HALF_PI 1.57079632679
 #define FOUR_PI 12.5663706144
-#define XZ_FALLOFF_DIST 1.f
-#define Y_FALLOFF_DIST 1.f
 
-// Params for adaptive ray marching
+// Params for adaptive ray marching; the quality preset may inject its own (see cloudDefines in main.cpp)
+#ifndef MIN_NUM_FINE_STEPS
 #define MIN_NUM_FINE_STEPS 16
-#define COARSE_STEPSIZE_MULTIPLIER 4.f
-#define SMALL_DENSITY 0.005f
+#endif
+#ifndef MAX_NUM_MISSED_STEPS
 #define MAX_NUM_MISSED_STEPS 5
+#endif
+#ifndef STEPSIZE_FINE
 #define STEPSIZE_FINE 0.02f
+#endif
+#define COARSE_STEPSIZE_MULTIPLIER 4.f
+#define SMALL_DENSITY 0.005f
+#define MAX_SKIPPED_CELLS 64  // occupancy-grid cells looked up per skip (USE_OCCUPANCY_GRID)
+
+// Feature flags, injected per variant: GAMMA_CORRECT, USE_LIGHT_VOLUME, USE_OCCUPANCY_GRID, FAR_STEP_DISTANCE (here),
+// INVERT_DENSITY, EROSION_CUBIC, MAX_DENSITY_LOD (cloudDensity.glsl)
 
 #define MAX_SUN_INTENSITY 4.f
-#define SUN_RADIUS 100.f
 
-// density volumes computed by the compute shader
-uniform sampler3D volumeHighRes;
-uniform sampler3D volumeLowRes;
 uniform sampler2D solidDepth;
 uniform sampler2D solidColor;
 uniform sampler1D sunGradient;
@@ -28,66 +32,105 @@ uniform sampler2D nightColor;
 //in vec3 positionWorld;
 in vec2 uv;
 in vec3 rayDirWorldspace;
+
+#ifdef CLOUD_MARCH_PASS
+// Checkerboard pass: the target is 1/checkerSize of the screen along each axis,
+// and every fragment marches one pixel of its checkerSize x checkerSize block (see cloudResolve.frag)
+layout(location = 0) out vec4 cloudSample;  // rgb: light scattered by the clouds, a: transmittance
+layout(location = 1) out float cloudDepth;  // distance along the ray used to reproject the sample
+uniform int checkerSize;
+uniform ivec2 checkerOffset;  // pixel of each block marched this frame
+uniform int frameIndex;       // decorrelates the ray-start jitter between frames
+uniform vec2 renderSize;      // full resolution of the cloud buffer being reconstructed
+uniform mat4 viewInverse;
+#else
 out vec4 glFragColor;
+uniform bool useCloudBuffer;  // take the clouds from the temporally resolved buffer instead of marching
+uniform sampler2D cloudBuffer;
+// Rendering into the reduced-resolution target: output linear color and leave the terrain and gamma
+// to bilateralUpsample.frag. Terrain pixels carry (cloud light, transmittance), sky pixels (color, 0).
+uniform bool upsampleSolid;
+#endif
 
-// volume transforms for computing ray-box intersection
-uniform vec3 volumeScaling, volumeTranslate;
+vec2 screenUV;  // uv of the full-resolution pixel being shaded
 
 // ray origin, updated when user moves camera
 uniform vec3 rayOrigWorld;
 
-// rendering params, updated when user changes settings
+// rendering params and light, updated when user changes settings
 //uniform float stepSize;
-uniform int numSteps;
-uniform bool invertDensity, gammaCorrect;
-uniform float densityMult;
-uniform float cloudLightAbsorptionMult;
-uniform float minLightTransmittance;
-
-// Params for high resolution noise
-uniform vec4 hiResNoiseScaling;
-uniform vec3 hiResNoiseTranslate;  // noise transforms
-uniform vec4 hiResChannelWeights;  // how to aggregate RGBA channels
-uniform float hiResDensityOffset;  // controls overall cloud coverage
-
-// Params for low resolution noise
-uniform float loResNoiseScaling;
-uniform vec3 loResNoiseTranslate;  // noise transforms
-uniform vec4 loResChannelWeights;  // how to aggregate RGBA channels
-uniform float loResDensityWeight;  // relative weight of lo-res noise about hi-res
+#include "renderParams.glsl"
 
 // Camera
 uniform float xMax, yMax;  // rayDirWorldspace lies within [-xMax, xMax] x [-yMax, yMax] x {1.0}
 uniform float near, far;   // terrain camera
-
-// light uniforms
-struct LightData {
-    int type;
-    vec4 pos;
-//    vec3 dir;  // towards light source
-    vec3 color;
-    float longitude;
-    float latitude;
-};
+uniform float pixelSpread; // world-space width of a pixel per unit of distance along its ray, picks the density mip
 
 uniform vec4 phaseParams;  // HG
-uniform LightData testLight;
 
+// sun transmittance over the cloud box baked by lightVolume.comb, replaces computeLightTransmittance
+uniform sampler3D lightVolume;
+
+// in-scattered sky light and view optical depth per direction, see skyView.comb
+uniform sampler2D skyViewLUT;
+
+// 0 for the macro cells of the cloud box where sampleDensity is 0 everywhere, see occupancyGrid.comb
+uniform sampler3D occupancyGrid;
+
+#include "atmosphere.glsl"
+#include "cloudDensity.glsl"
+
+// Length of the run of empty macro cells rayDir crosses from position (3D DDA over the grid), 0 if its cell may hold cloud.
+// occupiedExit: distance to the far side of the occupied cell the run ended at, no need to look again before it.
+float emptySpanLength(vec3 position, vec3 rayDir, out float occupiedExit) {
+    occupiedExit = 0.f;
+    const vec3 uvw = boxUVW(position);
+    if (any(lessThan(uvw, vec3(0.f))) || any(greaterThanEqual(uvw, vec3(1.f))))
+        return 0.f;
+    const ivec3 resolution = textureSize(occupancyGrid, 0);
+    ivec3 cell = ivec3(uvw * resolution);
+    const vec3 cellSize = volumeScaling / vec3(resolution);
+    const vec3 cellMin = (vec3(cell) / vec3(resolution) - .5f) * volumeScaling + volumeTranslate;
+    const ivec3 cellStep = ivec3(sign(rayDir));
+    const vec3 tDelta = abs(cellSize / rayDir);  // inf along axes the ray does not move on
+    vec3 tExit = (cellMin + step(0.f, rayDir) * cellSize - position) / rayDir;  // to the next cell on each axis
+
+    float span = 0.f;
+    for (int i = 0; i < MAX_SKIPPED_CELLS; i++) {
+        if (texelFetch(occupancyGrid, cell, 0).r > 0.f) {
+            occupiedExit = min(tExit.x, min(tExit.y, tExit.z));
+            break;
+        }
+        span = min(tExit.x, min(tExit.y, tExit.z));
+        const bvec3 nextAxis = lessThanEqual(tExit, vec3(span));
+        const int axis = nextAxis.x ? 0 : nextAxis.y ? 1 : 2;
+        cell[axis] += cellStep[axis];
+        tExit[axis] += tDelta[axis];
+        if (cell[axis] < 0 || cell[axis] >= resolution[axis])  // left the box, nothing more to march
+            break;
+    }
+    return max(span, 0.f);
+}
 
 
-vec3 dirSph2Cart(float latitudeRadians, float longitudeRadians) {
-    float x, y, z;
-    x = sin(longitudeRadians) * sin(latitudeRadians);
-    y = cos(longitudeRadians);
-    z = sin(longitudeRadians) * cos(latitudeRadians);
-    return vec3(x, y, z);
+// Step sizes grow in proportion to the distance from the camera past FAR_STEP_DISTANCE,
+// where the density mips are blurred to about the same scale anyway
+float farStepScale(float distance) {
+#ifdef FAR_STEP_DISTANCE
+    return max(1.f, distance / FAR_STEP_DISTANCE);
+#else
+    return 1.f;
+#endif
 }
 
-// normalized v so that dot(v, 1) = 1
-vec4 normalizeL1(vec4 v) {
-    return v / dot(v, vec4(1.f));
+// Length of the next step of a ray at distance from the camera: fine until MAX_NUM_MISSED_STEPS samples in a row
+// missed, coarse after that
+float nextStepSize(float fineStepSize, int missedStepsLeft, float distance) {
+    const float stepSize = missedStepsLeft <= 0? fineStepSize*COARSE_STEPSIZE_MULTIPLIER : fineStepSize;
+    return stepSize * farStepScale(distance);
 }
 
+
 // gamma correction
 float linear2srgb(float x) {
     if (x <= 0.0031308f)
@@ -105,26 +148,12 @@ float linearizeDepth(float depth) {
 }
 
 float depth2RayLength(float z) {
-    vec2 _uv = 2.f * uv - 1.f;
+    vec2 _uv = 2.f * screenUV - 1.f;
     float x = _uv[0] * xMax;
     float y = _uv[1] * yMax;
     return sqrt(x*x + y*y + z*z);
 }
 
-// fast AABB intersection
-vec2 intersectBox(vec3 orig, vec3 dir) {
-    vec3 boxMin = -.5f * volumeScaling + volumeTranslate;
-    vec3 boxMax = +.5f * volumeScaling + volumeTranslate;
-    vec3 invDir = 1.0 / dir;
-    vec3 tmin_tmp = (boxMin - orig) * invDir;
-    vec3 tmax_tmp = (boxMax - orig) * invDir;
-    vec3 tmin = min(tmin_tmp, tmax_tmp);
-    vec3 tmax = max(tmin_tmp, tmax_tmp);
-    float tn = max(tmin.x, max(tmin.y, tmin.z));
-    float tf = min(tmax.x, min(tmax.y, tmax.z));
-    return vec2(tn, tf);
-}
-
 // Pseudo-random number generator that approximtes U(0, 1)
 // http://www.reedbeta.com/blog/quick-and-easy-gpu-random-numbers-in-d3d11/
 float wangHash(int seed) {
@@ -136,14 +165,6 @@ float wangHash(int seed) {
     return float(seed % 2147483647) / 2147483647.f;
 }
 
-float getErosionWeightQuntic(float density) {
-    return pow( (1.f - density), 6 ) ;
-}
-
-float getErosionWeightCubic(float density) {
-    return (1.f - density) * (1.f - density) * (1.f - density);
-}
-
 // Henyey-Greenstein Phase Function
 // inParam: float angle, float phaseParam (forwardScattering, backwardScattering) --> this is passed in hyperparam
 // outParam: float phaseVal
@@ -159,133 +180,6 @@ float phase(float cosTheta) {
     return phaseParams.z + hgBlend * phaseParams.w;
 }
 
-float yFalloff(vec3 position) {
-    float ymin = -.5f * volumeScaling.y + volumeTranslate.y;
-    float ymax = ymin + volumeScaling.y;
-    float distY = min(Y_FALLOFF_DIST, min(position.y - ymin, ymax - position.y));
-    return distY / Y_FALLOFF_DIST;
-}
-
-float xzFalloff(vec3 position) {
-    float xmin = -.5f * volumeScaling.x + volumeTranslate.x;
-    float xmax = xmin + volumeScaling.x;
-    float zmin = -.5f * volumeScaling.z + volumeTranslate.z;
-    float zmax = zmin + volumeScaling.z;
-    float distX = min(XZ_FALLOFF_DIST, min(position.x - xmin, xmax - position.x));
-    float distZ = min(XZ_FALLOFF_DIST, min(position.z - zmin, zmax - position.z));
-    return min(distX, distZ) / XZ_FALLOFF_DIST;
-}
-
-float sampleDensity(vec3 position) {
-    // Sample high-res shape textures
-
-     vec3 hiResT = .1f * hiResNoiseTranslate;
-     vec4 hiResS = .1f * hiResNoiseScaling;
-
-     mat4x3 hiResPosition = outerProduct(position, hiResS) + outerProduct(hiResT, vec4(1.f));
-
-     vec4 hiResNoise = vec4(
-                texture(volumeHighRes, hiResPosition[0]).r,
-                texture(volumeHighRes, hiResPosition[1]).g,
-                texture(volumeHighRes, hiResPosition[2]).b,
-                texture(volumeHighRes, hiResPosition[3]).a
-                );
-    float hiResDensity = dot( hiResNoise, normalizeL1(hiResChannelWeights) );
-    if (invertDensity)
-        hiResDensity = 1.f - hiResDensity;
-
-    // Reduce density at the bottom of the cloud to create crisp shape
-    float falloff = yFalloff(position) * xzFalloff(position);
-    hiResDensity *= falloff;
-
-    // Control the cover of clouds by offsetting density
-    float hiResDensityWithOffset = hiResDensity + hiResDensityOffset;
-
-    // Skip adding details if there is no cloud to begin with
-    if (hiResDensityWithOffset <= 0.f)
-        return 0.f;
-
-    // Sample low-res detail textures
-     vec3 loResPosition = position * loResNoiseScaling * .1f + loResNoiseTranslate;
-     vec4 loResNoise = texture(volumeLowRes, loResPosition);
-    float loResDensity = dot( loResNoise, normalizeL1(loResChannelWeights) );
-    loResDensity = 1.f - loResDensity;  // invert the low-res density by default
-
-    // Detail erosion: subtract low-res detail from hi-res noise, weighted as such that
-    // the erosion is more pronounced near the boudary of the cloud (low hiResDensity)
-//     float erosionWeight = getErosionWeightCubic(hiResDensity);
-     float erosionWeight = getErosionWeightQuntic(hiResDensity);
-
-     float density = hiResDensityWithOffset - erosionWeight*loResDensityWeight * loResDensity;
-    return max(density * densityMult*5.f, 0.f);
-}
-
-// One-bounce raymarch to get light transmittance
-float computeLightTransmittance(vec3 rayOrig, vec3 rayDir) {
-     int numStepsRecursive = numSteps / 8;
-     vec2 tHit = intersectBox(rayOrig, rayDir);
-     float tFar = max(0.f, tHit.y);
-     float dt = tFar / numStepsRecursive;
-     vec3 ds = rayDir * dt;
-
-    float tau = 0.f;  // log transmittance
-    vec3 pointWorld = rayOrig;
-    for (float t = 0.f; t < tFar; t += dt) {
-         float density = sampleDensity(pointWorld);
-        tau -= density;
-        pointWorld += ds;
-    }
-    tau *= (cloudLightAbsorptionMult * dt);  // delay multiplication to save compute and avoid precision issues
-    float lightTransmittance = exp(tau);
-
-    // ambient hack to make clouds less dark
-    return minLightTransmittance + lightTransmittance * (1.f - minLightTransmittance);
-}
-
-//------------Skycolor-------------------------------------------------------------------
-// Simulates an atmosphere
-// return the distance traveled inside the atmosphere
-float raySphere(vec3 sphereCenter, float sphereRadius, vec3 rayOrigin, vec3 rayDir) {
-    vec3 offset = rayOrigin - sphereCenter;
-    float a = 1;
-    float b = 2 * dot(offset, rayDir);
-    float c = dot(offset, offset) - sphereRadius * sphereRadius;
-    float d = b*b - 4*a*c;
-
-    if (d >= 0) {
-        float s = sqrt(d);
-        float dstNear = max(0, (-b-s)/(2*a));
-        float dstFar = (-b+s)/(2*a);
-        if (dstFar >= 0) {
-            return dstFar - dstNear;
-        }
-    }
-    return 0.0;
-}
-
-// Used for sky scattering, simulates the particle density in the atmosphere
-float densityAtPoint(vec3 pointPosWorld, vec3 planetCenter, float planetRadius, float atmosRadius) {
-    float densityFalloff = 4.0;
-    float height = length(pointPosWorld - planetCenter) - planetRadius;
-    float height01 = height / (atmosRadius - planetRadius);
-    float density = exp(- height01 * densityFalloff) * (1 - height01);
-    return density;
-}
-
-// optical depth: average density along the ray, determined by the raylength (from point to the sun, within the atmosphere)
-float opticalDepth(vec3 rayOrig, vec3 rayDir, float rayLength, vec3 planetCenter, float planetRadius, float atmosRadius) {
-    int numOpticalPoints = 10;
-    vec3 densitySamplePoint = rayOrig;
-    float stepSize = rayLength / (numOpticalPoints - 1);
-    float opticalDepth = 0;
-    for (int i = 0; i < numOpticalPoints; i++) {
-        float localDensity = densityAtPoint(densitySamplePoint, planetCenter, planetRadius, atmosRadius);
-        opticalDepth += localDensity * stepSize;
-        densitySamplePoint += rayDir * stepSize;
-    }
-    return opticalDepth;
-}
-
 // query sun color texture based on height of the sun
 vec3 getSunColor(float longitudeRadians) {
     float timeOfDay = abs(longitudeRadians) / HALF_PI;  // 0: noon, 1: dusk/dawn
@@ -294,8 +188,8 @@ vec3 getSunColor(float longitudeRadians) {
 
 vec4 getNightColor(float longitudeRadians) {
     float timeOfDay = abs(longitudeRadians) / HALF_PI;  // 0: noon, 1: dusk/dawn
-    vec2 newUv = vec2(uv[0], 1.0 - uv[1]);
-    vec4 origColor = texture(nightColor, uv);
+    vec2 newUv = vec2(screenUV[0], 1.0 - screenUV[1]);
+    vec4 origColor = texture(nightColor, screenUV);
     float gray = 0.2989*origColor[0] + 0.5870*origColor[1] + 0.1140*origColor[2];
     float newR = -gray*timeOfDay + origColor[0]*(1+timeOfDay);
     float newG = -gray*timeOfDay + origColor[1]*(1+timeOfDay);
@@ -306,54 +200,26 @@ vec4 getNightColor(float longitudeRadians) {
 }
 
 
-void main() {
-    /* ---------------------- solid geometry ----------------------  */
-     float zSolid = linearizeDepth( texture(solidDepth, uv).r );
-     float tHitSolid = depth2RayLength(zSolid);
-     vec4 colorSolid = texture(solidColor, uv);
-
-    /* ---------------------------- ray ---------------------------- */
-    vec3 rayDirWorld = normalize(rayDirWorldspace);
+// Volume rendering with adaptive step sizes.
+// Returns the light scattered towards the camera (rgb) and the transmittance of the clouds (a);
+// hitDepth is the distance along the ray where the cloud is, weighted by how much each sample is seen.
+vec4 marchClouds(vec3 rayDirWorld, float tHitSolid, vec3 sunPos, vec3 sunColor, int seed, out float hitDepth) {
     vec2 tHit = intersectBox(rayOrigWorld, rayDirWorld);
     tHit.x = max(tHit.x, 0.f);  // keep the near intersection in front of the camera
     tHit.y = min(tHit.y, tHitSolid);  // keep far intersection in front of solid geometry
     vec3 pointWorld = rayOrigWorld + tHit.x * rayDirWorld;
 
-    /* -------------------------- light ---------------------------- */
-    float sunLatitudeRadians = radians(testLight.latitude);
-    float sunLongitudeRadians = radians(testLight.longitude);
-    vec3 sunDirSpherical = dirSph2Cart(sunLatitudeRadians, sunLongitudeRadians);
-    vec3 sunPos = SUN_RADIUS * sunDirSpherical;
     vec3 dirLight = normalize(sunPos - pointWorld);  // use actual sun location for more epic sunset
 //     vec3 dirLight = dirSph2Cart(sunLatitudeRadians, sunLongitudeRadians);  // towards the light
 
     float cosRayLightAngle = dot(rayDirWorld, dirLight);
     float phaseVal = phase(cosRayLightAngle);  // directional light only for now
-    vec3 sunColor = getSunColor(sunLongitudeRadians);
-
-    /* ----------------------------- sky -------------------------- */
-    vec3 inScatteredLight = vec3(0.0, 0.0, 0.0);
-    float scatteringStrength = 0.09;
-    vec3 wavelengths = vec3(700, 530, 440);
-    float scatterR = pow(400 / wavelengths[0], 4) * scatteringStrength;
-    float scatterG = pow(400 / wavelengths[1], 4) * scatteringStrength;
-    float scatterB = pow(400 / wavelengths[2], 4) * scatteringStrength;
-    vec3 scatteringCoeff = vec3(scatterR, scatterG, scatterB);
-
-    float viewRayOpticalDepth = 0.0;
-    int numInScatteringPoints = 10;
-
-    // Create atmosphere
-    float atmosRadius = 1050.0 ;
-    float planetRadius = 1000.0;
-    vec3 planetCenter = vec3(0.0, -planetRadius, 0.0);
 
-    // ================================================================== //
-
-    // Volume rendering with adaptive step sizes
     vec3 cloudColor = vec3(0.f);
     float transmittance = 1.f;
     float lightEnergy = 0.f;
+    float depthWeight = 0.f;
+    hitDepth = far;  // nothing to reproject against, treat it as far away
     if (tHit.x < tHit.y) {  // hit box
         // Starting from the near intersection, march the ray forward and sample
         float dstTravelled = 0;
@@ -361,21 +227,58 @@ void main() {
         float curFineStepSize = min(STEPSIZE_FINE, totalDst/MIN_NUM_FINE_STEPS);
         float curCoarseStepSize = curFineStepSize*COARSE_STEPSIZE_MULTIPLIER;
         int curThreshold = MAX_NUM_MISSED_STEPS;
-        float dt = curCoarseStepSize;
+        float dt = curCoarseStepSize * farStepScale(tHit.x);
+        float nextGridLookup = 0.f;  // USE_OCCUPANCY_GRID: distance at which the ray leaves the last occupied cell
 
         // Optionally apply random offset on ray start to minimize color banding
-         int seed = int(gl_FragCoord.y + 3000 * gl_FragCoord.x);
          float eps = wangHash(seed);
          float offset = eps * curFineStepSize;  // max offset is one coarse step
         pointWorld += offset * rayDirWorld;
         dstTravelled += offset;
 
+        hitDepth = 0.f;
         while (dstTravelled < totalDst) {
-            // sample density and evaluate vol rendering equation
-            float density = sampleDensity(pointWorld);
+#ifdef USE_OCCUPANCY_GRID
+            // Step over empty macro cells without sampling them. Their samples would all have missed, so only
+            // the missed-step countdown is replayed: the samples after the cells land where they always did.
+            if (dstTravelled >= nextGridLookup) {
+                float occupiedExit;
+                const float tSkip = emptySpanLength(pointWorld, rayDirWorld, occupiedExit);
+                if (tSkip > 0.f) {
+                    const float skipTo = dstTravelled + tSkip;
+#ifdef FAR_STEP_DISTANCE
+                    while (dstTravelled < skipTo) {  // steps change with distance, take them one by one
+                        curThreshold -= 1;
+                        dstTravelled += dt;
+                        dt = nextStepSize(curFineStepSize, curThreshold, tHit.x + dstTravelled);
+                    }
+#else
+                    while (dstTravelled < skipTo && curThreshold > 0) {
+                        curThreshold -= 1;
+                        dstTravelled += dt;
+                        dt = nextStepSize(curFineStepSize, curThreshold, tHit.x + dstTravelled);
+                    }
+                    if (dstTravelled < skipTo)  // coarse steps from here on
+                        dstTravelled += ceil((skipTo - dstTravelled) / dt) * dt;
+#endif
+                    pointWorld = rayOrigWorld + (tHit.x + dstTravelled) * rayDirWorld;
+                    continue;
+                }
+                nextGridLookup = dstTravelled + occupiedExit;
+            }
+#endif
+            // sample density and evaluate vol rendering equation, filtered over the pixel cone or the fine step
+            const float t = tHit.x + dstTravelled;
+            float density = sampleDensity(pointWorld, max(t * pixelSpread, curFineStepSize * farStepScale(t)));
             if (density > 0.f) {
+#ifdef USE_LIGHT_VOLUME
+                float lightTransmittance = texture(lightVolume, boxUVW(pointWorld)).r;
+#else
                 float lightTransmittance = computeLightTransmittance(pointWorld, dirLight);
+#endif
                 lightEnergy += density * transmittance * lightTransmittance * dt;
+                hitDepth += (tHit.x + dstTravelled) * density * transmittance * dt;
+                depthWeight += density * transmittance * dt;
                 transmittance *= (1 - density * cloudLightAbsorptionMult * dt);  // Taylor approx for exp(-density * cloudLightAbsorptionMult * dt)
                 if (transmittance < EARLY_STOP_THRESHOLD)
                     break;
@@ -389,39 +292,68 @@ void main() {
             pointWorld += rayDirWorld * dt;
 
             // switch to coarse if we missed too many steps, otherwise use fine
-            dt = curThreshold <= 0? curCoarseStepSize : curFineStepSize;
+            dt = nextStepSize(curFineStepSize, curThreshold, tHit.x + dstTravelled);
         }
+        hitDepth = depthWeight > 0.f ? hitDepth / depthWeight : tHit.y;  // empty box: its far side
 
         // TODO: adjust sunColor at night
         lightEnergy *= phaseVal;
         cloudColor = lightEnergy * sunColor;
     }
+    return vec4(cloudColor, transmittance);
+}
 
 
-    //----------------------------skycolor related-------------------------------
-    // Compute color of the sky (background)
-    float scaler = 70.0;
-    pointWorld = rayOrigWorld;
-    float rayLength = raySphere(planetCenter, atmosRadius, pointWorld, normalize(rayDirWorld));
-    float stepSize = rayLength / (numInScatteringPoints - 1);
+void main() {
+#ifdef CLOUD_MARCH_PASS
+    // full-resolution pixel this fragment stands in for
+    const ivec2 pixel = ivec2(gl_FragCoord.xy) * checkerSize + checkerOffset;
+    const vec2 fragCoord = vec2(pixel) + .5f;
+    screenUV = fragCoord / renderSize;
+    vec2 ndc = 2.f * screenUV - 1.f;
+    vec3 rayDirWorld = normalize(vec3(viewInverse * vec4(ndc.x * xMax, ndc.y * yMax, -1.f, 0.f)));
+    int seed = int(fragCoord.y + 3000 * fragCoord.x) + 7919 * frameIndex;
+#else
+    screenUV = uv;
+    const vec2 fragCoord = gl_FragCoord.xy;
+    vec3 rayDirWorld = normalize(rayDirWorldspace);
+    int seed = int(fragCoord.y + 3000 * fragCoord.x);
+#endif
 
-    for (int i = 0; i < numInScatteringPoints; i++) {
-        float localDensity = densityAtPoint(pointWorld, planetCenter, planetRadius, atmosRadius);
-        float sunRayLength = raySphere(planetCenter, atmosRadius, pointWorld, sunDirSpherical) ;
+    /* ---------------------- solid geometry ----------------------  */
+     float zSolid = linearizeDepth( texture(solidDepth, screenUV).r );
+     float tHitSolid = depth2RayLength(zSolid);
+     vec4 colorSolid = texture(solidColor, screenUV);
 
-        float sunRayOpticalDepth = opticalDepth(pointWorld, sunDirSpherical, sunRayLength, planetCenter, planetRadius, atmosRadius) ;
+    /* -------------------------- light ---------------------------- */
+    float sunLatitudeRadians = radians(testLight.latitude);
+    float sunLongitudeRadians = radians(testLight.longitude);
+    vec3 sunDirSpherical = dirSph2Cart(sunLatitudeRadians, sunLongitudeRadians);
+    vec3 sunPos = SUN_RADIUS * sunDirSpherical;
+    vec3 sunColor = getSunColor(sunLongitudeRadians);
 
-        viewRayOpticalDepth = opticalDepth(pointWorld, -rayDirWorld, stepSize * i, planetCenter, planetRadius, atmosRadius);
-        vec3 transSky = exp( -(sunRayOpticalDepth + viewRayOpticalDepth)*scatteringCoeff );
-        inScatteredLight += localDensity * transSky * scatteringCoeff * stepSize;
-        pointWorld += rayDirWorld * stepSize;
-    }
+    /* --------------------------- clouds -------------------------- */
+    float hitDepth;
+#ifdef CLOUD_MARCH_PASS
+    cloudSample = marchClouds(rayDirWorld, tHitSolid, sunPos, sunColor, seed, hitDepth);
+    cloudDepth = hitDepth;
+#else  // sky and compositing happen in the full-resolution pass only
+    vec4 clouds = useCloudBuffer ? texelFetch(cloudBuffer, ivec2(fragCoord), 0)
+                                 : marchClouds(rayDirWorld, tHitSolid, sunPos, sunColor, seed, hitDepth);
+    vec3 cloudColor = clouds.rgb;
+    float transmittance = clouds.a;
+
+    /* ----------------------------- sky -------------------------- */
+    // in-scattered light and optical depth of the view ray, baked by skyView.comb
+    vec4 skyView = texture(skyViewLUT, skyViewUV(rayDirWorld));
+    vec3 inScatteredLight = skyView.rgb;
+    float viewRayOpticalDepth = skyView.a;
 
     vec3 backgroundColor;
     float sunIntensity;
     float timeOfDay = abs(sunLongitudeRadians) / HALF_PI;  // 0: noon, 1: dusk/dawn
 
-    if (raySphere(planetCenter, planetRadius, rayOrigWorld, rayDirWorld) > 0.0) {
+    if (raySphere(PLANET_CENTER, PLANET_RADIUS, rayOrigWorld, rayDirWorld) > 0.0) {
         // if below the horizon, set bg to black and zero sun intensity
         backgroundColor = vec3(0.f);
         sunIntensity = 0;
@@ -446,7 +378,8 @@ void main() {
         sunIntensity = henyeyGreenstein(dot(rayDirWorld, sunDirSpherical), .9995) * transmittance;
         sunIntensity = min(sunIntensity, MAX_SUN_INTENSITY);
     }
-    if (texture(solidDepth, uv).r < 1) {  // hit solid
+    bool hitSolid = texture(solidDepth, screenUV).r < 1;
+    if (hitSolid) {  // hit solid
         backgroundColor = colorSolid.rgb;
         sunIntensity = 0;
     }
@@ -461,10 +394,14 @@ void main() {
     // blend sun color in cloud+bg
     vec3 compositeColor = cloudOnBackground * max(1-sunIntensity, 0.f) + sunColor * sunIntensity;
 
-    if (gammaCorrect)
-        compositeColor = gammaCorrection(compositeColor);
-    glFragColor = vec4(compositeColor, 1.f);
+    if (upsampleSolid) {
+        glFragColor = hitSolid ? vec4(cloudColor, transmittance) : vec4(compositeColor, 0.f);
+        return;
+    }
 
+#ifdef GAMMA_CORRECT
+    compositeColor = gammaCorrection(compositeColor);
+#endif
+    glFragColor = vec4(compositeColor, 1.f);
+#endif
 }
-
-
@@ -0,0 +1,42 @@
+// Settings shared by every program that shades the scene, one std140 block bound once by the application
+// (RenderParams in src/renderparams.h, RENDER_PARAMS_BINDING in main.cpp). Include after #version.
+#ifndef RENDER_PARAMS_GLSL
+#define RENDER_PARAMS_GLSL
+
+struct LightData {
+    int type;
+    vec4 pos;
+    vec3 dir;  // towards light source
+    vec3 color;
+    float longitude;
+    float latitude;
+};
+
+layout(std140, binding = 0) uniform RenderParams {
+    LightData testLight;
+
+    // volume transforms for computing ray-box intersection
+    vec3 volumeScaling;
+    int numSteps;
+    vec3 volumeTranslate;
+    float densityMult;
+
+    // Params for high resolution noise
+    vec4 hiResNoiseScaling;
+    vec3 hiResNoiseTranslate;  // noise transforms
+    float hiResDensityOffset;  // controls overall cloud coverage
+    vec4 hiResChannelWeights;  // how to aggregate RGBA channels
+
+    // Params for low resolution noise
+    vec3 loResNoiseTranslate;  // noise transforms
+    float loResNoiseScaling;
+    vec4 loResChannelWeights;  // how to aggregate RGBA channels
+
+    vec2 unormDensityRange;  // with VOLUME_UNORM, texel values [0, 1] map back to this range
+    float cloudLightAbsorptionMult;
+    float minLightTransmittance;
+    float loResDensityWeight;  // relative weight of lo-res noise about hi-res
+    bool gammaCorrect;         // bilateralUpsample.frag; the ray marcher compiles it in (GAMMA_CORRECT)
+};
+
+#endif
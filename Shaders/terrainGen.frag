@@ -12,15 +12,7 @@ in vec2 uv;
 uniform sampler2D color_sampler;
 
 // light uniforms
-struct LightData {
-    int type;
-    vec4 pos;
-    vec3 dir;  // towards light source
-    vec3 color;
-    float longitude;
-    float latitude;
-};
-uniform LightData testLight;
+#include "renderParams.glsl"
 uniform vec3 ambientColor = vec3(1.f);
 uniform float ka = 0.3;
 uniform float kd = 0.7;
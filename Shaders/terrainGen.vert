@@ -1,5 +1,8 @@
 #version 460 core
 layout(location = 0) in vec2 vertex;
+layout(location = 1) in vec4 patchNode;  // per instance, CDLOD: xy origin, z size, w level; tiles: xy origin, z layer
+
+#define MAX_LOD_LEVELS 16  // TerrainLOD::MAX_LEVELS
 
 //out vec4 vert;
 out vec4 sample_norm;
@@ -13,20 +16,60 @@ uniform mat4 transInvViewMatrix;
 uniform sampler2D height_sampler;
 uniform sampler2D normal_sampler;
 
+// CDLOD: vertex is a point of the unit patch, placed and morphed per instance (see TerrainLOD)
+uniform bool useLOD = false;
+uniform int patchGrid;                       // quads per patch side
+uniform vec3 lodCameraPos;                   // camera in terrain space, (x, height, z)
+uniform vec2 morphRanges[MAX_LOD_LEVELS];    // distances over which each level morphs into the next
+uniform vec2 terrainExtent;
+
+// Tiles: vertex is a point of the unit tile, its height and normal are one texel of the tile's layer (see TerrainTiles)
+uniform bool useTiles = false;
+uniform sampler2DArray tileMaps;  // xyz: normal, w: height
+uniform int tileResolution;       // quads per tile side
+
+vec2 heightUV(vec2 xz) {
+    return fract(xz.yx * terrainNoiseScaling);
+}
+
+float terrainHeight(vec2 xz) {
+    return texture(height_sampler, heightUV(xz)).r / terrainNoiseScaling / 3;
+}
+
+// Slides the odd vertices of the patch onto their even neighbours as the camera moves away,
+// so at the end of the range the patch matches the next coarser level along its edges
+vec2 morphedVertex() {
+    const vec2 gridPos = vertex * patchGrid;
+    const vec2 pos = patchNode.xy + vertex * patchNode.z;
+    const vec2 range = morphRanges[int(patchNode.w)];
+    const float dist = distance(vec3(pos.x, terrainHeight(pos), pos.y), lodCameraPos);
+    const float morph = clamp((dist - range.x) / (range.y - range.x), 0.f, 1.f);
+    const vec2 odd = fract(gridPos * .5f) * 2.f;
+    return min(pos - odd * morph * patchNode.z / patchGrid, terrainExtent);
+}
+
 void main()
 {
-    vec2 uv = vertex.yx;
-    uv *= terrainNoiseScaling;
-    uv = fract(uv);
-
     lightDir = normalize(vec3(1.0,0.0,1.0));
 
+    if (useTiles) {
+        const ivec2 texel = ivec2(round(vertex * tileResolution));
+        const vec4 tile = texelFetch(tileMaps, ivec3(texel.yx, int(patchNode.z)), 0);
+        sample_norm = transInvViewMatrix * vec4(tile.xyz, 0.0);
+        const vec2 xz = patchNode.xy + vertex;
+        gl_Position = projViewMatrix * vec4(xz.x, tile.w / terrainNoiseScaling / 3, xz.y, 1.0);
+        return;
+    }
+
+    const vec2 xz = useLOD ? morphedVertex() : vertex;
+    vec2 uv = heightUV(xz);
+
     // sample and pass norm to fragment shader
     sample_norm  = transInvViewMatrix * vec4(texture(normal_sampler, uv).rgb, 0.0);
 
     // height map sampling
-    float height = texture(height_sampler, uv).r / terrainNoiseScaling / 3;
-    vec3 pos = vec3(vertex.x, height, vertex.y);
+    float height = terrainHeight(xz);
+    vec3 pos = vec3(xz.x, height, xz.y);
     gl_Position = projViewMatrix * vec4(pos, 1.0);
 
 }
@@ -3,13 +3,23 @@
 #include <ostream>
 #include <iostream>
 
-FBO::FBO(int default_fbo, int fbo_width, int fbo_height) {
+FBO::FBO(int default_fbo, int fbo_width, int fbo_height, GLenum color_internal_format) {
     m_defaultFBO = default_fbo;
     m_fbo_width = fbo_width;
     m_fbo_height = fbo_height;
+    m_color_internal_format = color_internal_format;
     init();
 }
 
+void FBO::bind() {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glViewport(0, 0, m_fbo_width, m_fbo_height);
+}
+
+void FBO::unbind() {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_defaultFBO);
+}
+
 // GET functions
 int FBO::getFBOWidth() {
     return m_fbo_width;
@@ -108,9 +118,11 @@ void FBO::makeFBO() {
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, m_fbo_color_texture);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_fbo_width, m_fbo_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, m_color_internal_format, m_fbo_width, m_fbo_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
     // Task 18: Generate and bind an FBO
     glGenFramebuffers(1, &m_fbo);
@@ -137,6 +149,21 @@ void FBO::makeFBO() {
 
 }
 
+void FBO::resize(int new_fbo_width, int new_fbo_height) {
+    deleteDepthTexture();
+    deleteColorTexture();
+    deleteFrameBuffer();
+    setFboWidth(new_fbo_width);
+    setFboHeight(new_fbo_height);
+    makeFBO();
+}
+
+void FBO::drawFullscreenQuad() {
+    glBindVertexArray(m_fullscreen_vao);
+    glDrawArrays(GL_TRIANGLES, 0, fullscreen_quad_data.size() / 5);
+    glBindVertexArray(0);
+}
+
 void FBO::init() {
     generateBindFullscreen();
 }
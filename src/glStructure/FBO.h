@@ -9,10 +9,11 @@
 class FBO
 {
 public:
-    FBO(int default_fbo, int fbo_width, int fbo_height);
+    // color_internal_format: storage of the color attachment, e.g. GL_RGBA16F for HDR intermediate targets
+    FBO(int default_fbo, int fbo_width, int fbo_height, GLenum color_internal_format = GL_RGBA);
     void init();
-    void bind();
-    void unbind();
+    void bind();    // also sets the viewport to the FBO size
+    void unbind();  // back to the default framebuffer, the caller restores its viewport
     void send(int buffer_size, const void * data_ptr);
     void update_data(int new_size, const void * new_data_ptr);
     void paintTexture(GLuint texture, bool post_processing, int post_processing_type);
@@ -40,6 +41,8 @@ public:
     // Functionality
     void generateBindFullscreen();
     void makeFBO();
+    void resize(int new_fbo_width, int new_fbo_height);  // recreate the attachments at a new size
+    void drawFullscreenQuad();  // for full-screen passes such as compositing this FBO onto another
     void paintTexture(bool post_processing, int post_processing_type);
 
 
@@ -56,6 +59,7 @@ private:
     GLuint m_fbo_depth_texture;
     GLuint m_fbo_renderbuffer;
     GLuint m_fbo_color_texture;
+    GLenum m_color_internal_format;
     std::vector<GLuint> m_DrawBuffers = std::vector<GLuint>(3);
 
 
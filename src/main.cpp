@@ -1,13 +1,23 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <iomanip>
 #include "utils/shaderloader.h"
+#include "utils/shaderhotreload.h"
+#include "utils/gpuprofiler.h"
+#include "imgui.h"
+#include "imgui_impl_glfw.h"
+#include "imgui_impl_opengl3.h"
 #include <array>
+#include <algorithm>
 #include "setting.h"
+#include "renderparams.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <vector>
 #include "terrain/terraingenerator.h"
+#include "terrain/terrainlod.h"
+#include "terrain/terraintiles.h"
 #include "camera/camera.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/component_wise.hpp>
@@ -15,13 +25,57 @@
 #include "noise/worley.h"
 #include "utils/debug.h"
 #include <memory>
+#include <cstring>
 #include "glStructure/FBO.h"
-
-GLuint m_volumeShader,  m_worleyShader, m_terrainShader, m_terrainTextureShader;
+#include "noise/volumecache.h"
+#include "utils/json.h"
+#include "utils/headlesscontext.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+
+GLuint m_volumeShader,  m_worleyShader, m_worleyTiledShader, m_lightVolumeShader, m_terrainShader, m_terrainTextureShader;
+GLuint m_cloudMarchShader, m_cloudResolveShader;  // temporal cloud passes, see drawCloudsTemporal
+ShaderPermutations m_cloudShaders;        // default.frag variants, m_volumeShader and m_cloudMarchShader among them
+ShaderPermutations m_lightVolumeShaders;  // lightVolume.comb variants, m_lightVolumeShader among them
+GLuint m_occupancyGridShader;
+ShaderPermutations m_occupancyGridShaders;  // occupancyGrid.comb variants, m_occupancyGridShader among them
+GLuint m_volumeMipShader;  // volumeMip.comb, see generateVolumeMips
+GLuint m_upsampleShader;  // bilateral upsample of m_cloudFBO, see drawCloudUpsample
+GLuint m_transmittanceLUTShader, m_skyViewShader;
+GLuint m_terrainHeightShader, m_terrainNormalShader;  // GPU terrain maps, see generateTerrainMapsGPU
+std::unique_ptr<ShaderHotReload> m_shaderHotReload;  // null unless settings.hotReloadShaders
+GpuProfiler m_profiler;  // CPU/GPU time per pass, shown by the overlay in main
 GLuint vboScreenQuad, vaoScreenQuad;
 GLuint vboVolume, vaoVolume;
 GLuint volumeTexHighRes, volumeTexLowRes;
+GLuint volumeTexHighResChannels[4], volumeTexLowResChannels[4];  // VOLUME_R8_CHANNELS only
+GLuint lightVolumeTex;       // sun transmittance over the cloud box, see bakeLightVolume
+GLuint occupancyGridTex;     // macro cells of the cloud box that may hold cloud, see bakeOccupancyGrid
+GLuint transmittanceLUTTex, skyViewLUTTex;  // precomputed sky, see bakeSkyView
+glm::vec2 skyViewSun;        // sun longitude/latitude and camera position the sky-view LUT was baked for
+glm::vec3 skyViewOrigin;
+bool skyViewDirty = true;
+bool lightVolumeDirty = true;  // noise volumes were rebaked since the last light-volume bake
+bool occupancyGridDirty = true;  // same for the occupancy grid
+// Temporal cloud marching: 1/cloudCheckerSize^2 of the pixels are marched into cloudSampleTex,
+// then resolved with last frame's cloudHistoryTex into the other history texture
+GLuint cloudSampleFBO, cloudSampleTex, cloudSampleDepthTex;
+GLuint cloudHistoryFBO[2], cloudHistoryTex[2];
+int cloudHistoryIdx = 0;          // history texture written this frame
+int cloudTargetsCheckerSize = 0;  // checker size and resolution the targets above were allocated for
+glm::ivec2 cloudTargetsSize;
+bool cloudHistoryValid = false;
+unsigned frameIndex = 0;
+glm::mat4 prevProjView;           // camera of the frame in the history
 GLuint ssboWorley;
+GLuint ssboWorleyAllChannels;
+GLuint ssboPerlinGradient;
+GLuint uboRenderParams;
+bool renderParamsDirty = true;  // settings changed since uboRenderParams was last written
 GLuint sunTexture;
 GLuint nightTexture;
 Camera m_camera;
@@ -33,6 +87,9 @@ GLuint m_terrain_color_texture;
 // Terrain
     std::vector<float> m_terrain_data;
     GLuint m_terrain_vbo;
+    GLuint m_terrain_ebo;  // TERRAIN_MESH_INDEXED / TERRAIN_MESH_STRIP only
+    GLsizei m_terrain_index_count = 0;
+    GLuint m_terrain_patch_vbo;  // TERRAIN_MESH_CDLOD / TERRAIN_MESH_TILES only, per-instance patches of this frame
     GLuint m_terrain_vao;
 
     glm::mat4 m_proj;
@@ -44,8 +101,12 @@ GLuint m_terrain_color_texture;
     int m_screen_height;
 
     TerrainGenerator m_terrain;
+    TerrainLOD m_terrainLOD;
+    std::unique_ptr<TerrainTiles> m_terrainTiles;  // TERRAIN_MESH_TILES only
 
-std::unique_ptr<FBO> m_FBO;
+std::unique_ptr<FBO> m_FBO;       // terrain color and depth at full resolution
+std::unique_ptr<FBO> m_cloudFBO;  // clouds and sky when settings.cloudDownsample > 1
+VolumeCache m_volumeCache;
 bool glInitialized = false;
 
 constexpr std::array<GLfloat, 42> cube = {
@@ -67,14 +128,52 @@ constexpr auto szVec4() { return sizeof(GLfloat) * 4; }
 
 constexpr auto WORLEY_MAX_CELLS_PER_AXIS = 32;
 constexpr auto WORLEY_MAX_NUM_POINTS = WORLEY_MAX_CELLS_PER_AXIS * WORLEY_MAX_CELLS_PER_AXIS * WORLEY_MAX_CELLS_PER_AXIS;
+constexpr auto WORLEY_TILE_SIZE = 8;  // local size of worleyTiled.comb along each axis
+constexpr auto LIGHT_VOLUME_GROUP_SIZE = 4;  // local size of lightVolume.comb along each axis
+constexpr auto LIGHT_VOLUME_TEXTURE_UNIT = 16;
+constexpr auto OCCUPANCY_GRID_GROUP_SIZE = 4;  // local size of occupancyGrid.comb along each axis
+constexpr auto OCCUPANCY_GRID_TEXTURE_UNIT = 25;
+constexpr auto VOLUME_MIP_GROUP_SIZE = 4;  // local size of volumeMip.comb along each axis
+constexpr auto VOLUME_MIP_SOURCE_TEXTURE_UNIT = 26;
+constexpr auto CLOUD_SAMPLES_TEXTURE_UNIT = 17;
+constexpr auto CLOUD_SAMPLE_DEPTH_TEXTURE_UNIT = 18;
+constexpr auto CLOUD_HISTORY_TEXTURE_UNIT = 19;
+constexpr auto CLOUD_BUFFER_TEXTURE_UNIT = 20;
+constexpr auto CLOUD_LOW_RES_TEXTURE_UNIT = 21;
+constexpr auto TRANSMITTANCE_LUT_TEXTURE_UNIT = 22;
+constexpr auto SKY_VIEW_LUT_TEXTURE_UNIT = 23;
+constexpr auto TERRAIN_TILES_TEXTURE_UNIT = 24;
+constexpr auto SKY_LUT_GROUP_SIZE = 8;  // local size of transmittanceLUT.comb and skyView.comb along x and y
+constexpr glm::ivec2 TRANSMITTANCE_LUT_SIZE(256, 64);  // cos zenith angle x height
+constexpr glm::ivec2 SKY_VIEW_LUT_SIZE(256, 128);      // azimuth x elevation
+constexpr auto TERRAIN_MAP_GROUP_SIZE = 16;  // local size of terrainHeight.comb and terrainNormal.comb along x and y
+constexpr auto PERLIN_GRADIENT_BINDING = 3;  // SSBO of terrainHeight.comb
+constexpr auto RENDER_PARAMS_BINDING = 0;    // UBO of renderParams.glsl
+
+// The point SSBOs hold at most WORLEY_MAX_CELLS_PER_AXIS cells per axis; hashed points have no limit
+bool fitsWorleyPointBuffers(const NoiseParams &noiseParams) {
+    for (const auto &params : noiseParams.worleyPointsParams) {
+        if (std::max({params.cellsPerAxisFine, params.cellsPerAxisMedium, params.cellsPerAxisCoarse}) > WORLEY_MAX_CELLS_PER_AXIS) {
+            std::cerr << "Worley: more than " << WORLEY_MAX_CELLS_PER_AXIS
+                      << " cells per axis needs settings.hashWorleyPoints, volume not baked" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Settings::noiseSeed as the uvec2 the hashed Worley shaders take
+void setNoiseSeedUniform(GLuint program) {
+    glUniform2ui(glGetUniformLocation(program, "noiseSeed"), GLuint(settings.noiseSeed), GLuint(settings.noiseSeed >> 32));
+}
 
 //Update worley points
 void updateWorleyPoints(const WorleyPointsParams &worleyPointsParams) {
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboWorley);
     {
-        auto worleyPointsFine = Worley::createWorleyPointArray3D(worleyPointsParams.cellsPerAxisFine);
-        auto worleyPointsMedium = Worley::createWorleyPointArray3D(worleyPointsParams.cellsPerAxisMedium);
-        auto worleyPointsCoarse = Worley::createWorleyPointArray3D(worleyPointsParams.cellsPerAxisCoarse);
+        auto worleyPointsFine = Worley::createWorleyPointArray3D(worleyPointsParams.cellsPerAxisFine, settings.noiseSeed);
+        auto worleyPointsMedium = Worley::createWorleyPointArray3D(worleyPointsParams.cellsPerAxisMedium, settings.noiseSeed);
+        auto worleyPointsCoarse = Worley::createWorleyPointArray3D(worleyPointsParams.cellsPerAxisCoarse, settings.noiseSeed);
         glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, worleyPointsFine.size()*szVec4(), worleyPointsFine.data());
         glBufferSubData(GL_SHADER_STORAGE_BUFFER, WORLEY_MAX_NUM_POINTS*szVec4(), worleyPointsMedium.size()*szVec4(), worleyPointsMedium.data());
         glBufferSubData(GL_SHADER_STORAGE_BUFFER, 2*WORLEY_MAX_NUM_POINTS*szVec4(), worleyPointsCoarse.size()*szVec4(), worleyPointsCoarse.data());
@@ -82,6 +181,793 @@ void updateWorleyPoints(const WorleyPointsParams &worleyPointsParams) {
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
+//Update worley points of all four channels, for the single-dispatch tiled shader
+void updateWorleyPointsAllChannels(const NoiseParams &noiseParams) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboWorleyAllChannels);
+    for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
+        const auto &worleyPointsParams = noiseParams.worleyPointsParams[channelIdx];
+        const int cellsPerAxis[3] = {worleyPointsParams.cellsPerAxisFine,
+                                     worleyPointsParams.cellsPerAxisMedium,
+                                     worleyPointsParams.cellsPerAxisCoarse};
+        for (int layer = 0; layer < 3; layer++) {
+            auto worleyPoints = Worley::createWorleyPointArray3D(cellsPerAxis[layer], settings.noiseSeed);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, (3*channelIdx + layer)*WORLEY_MAX_NUM_POINTS*szVec4(),
+                            worleyPoints.size()*szVec4(), worleyPoints.data());
+        }
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// How each VolumeFormat is allocated, written by the Worley shaders and sampled
+struct VolumeFormatInfo {
+    const char *name;
+    GLenum internalFormat;     // of each texture
+    const char *imageFormat;   // GLSL image format qualifier matching internalFormat
+    bool unorm;                // densities remapped from settings.unormDensityRange to [0, 1]
+    bool splitChannels;        // one single-channel texture per RGBA channel
+    int bytesPerVoxel;         // all four channels together
+};
+
+constexpr std::array<VolumeFormatInfo, VOLUME_FORMAT_COUNT> VOLUME_FORMATS = {{
+    {"RGBA32F", GL_RGBA32F, "rgba32f", false, false, 16},
+    {"RGBA16F", GL_RGBA16F, "rgba16f", false, false, 8},
+    {"RGBA8",   GL_RGBA8,   "rgba8",   true,  false, 4},
+    {"R8 x4",   GL_R8,      "r8",      true,  true,  4},
+}};
+
+const VolumeFormatInfo &volumeFormatInfo() { return VOLUME_FORMATS[settings.volumeFormat]; }
+
+// Preprocessor lines selecting the storage format in the Worley and volume shaders
+std::string volumeFormatDefines() {
+    const auto &format = volumeFormatInfo();
+    std::string defines = std::string("#define VOLUME_IMAGE_FORMAT ") + format.imageFormat + '\n';
+    if (format.unorm) defines += "#define VOLUME_UNORM\n";
+    if (format.splitChannels) defines += "#define VOLUME_SPLIT_CHANNELS\n";
+    return defines;
+}
+
+// Variant of worley.comb and worleyTiled.comb: storage format and where the cell points come from
+std::string worleyDefines() {
+    std::string defines = volumeFormatDefines();
+    if (settings.hashWorleyPoints) defines += "#define WORLEY_HASHED_POINTS\n";
+    return defines;
+}
+
+// Variant of cloudDensity.glsl: storage format and the density features that are switched on
+std::string densityDefines() {
+    std::string defines = volumeFormatDefines();
+    if (settings.invertDensity) defines += "#define INVERT_DENSITY\n";
+    if (settings.cubicErosion) defines += "#define EROSION_CUBIC\n";
+    if (settings.densityMaxLod > 0) defines += "#define MAX_DENSITY_LOD " + std::to_string(settings.densityMaxLod) + '\n';
+    return defines;
+}
+
+// Variant of default.frag for the current settings; marchPass: the checkerboard pass of drawCloudsTemporal
+std::string cloudDefines(bool marchPass) {
+    struct Preset { const char *stepSizeFine; int minFineSteps, maxMissedSteps; };
+    static constexpr Preset PRESETS[CLOUD_QUALITY_COUNT] = {
+        {"0.04f", 8, 3},   // CLOUD_QUALITY_LOW
+        {"0.03f", 12, 4},  // CLOUD_QUALITY_MEDIUM
+        {"0.02f", 16, 5},  // CLOUD_QUALITY_HIGH
+    };
+    const Preset &preset = PRESETS[std::clamp(settings.cloudQuality, 0, CLOUD_QUALITY_COUNT - 1)];
+    std::string defines = densityDefines();
+    defines += std::string("#define STEPSIZE_FINE ") + preset.stepSizeFine + '\n';
+    defines += "#define MIN_NUM_FINE_STEPS " + std::to_string(preset.minFineSteps) + '\n';
+    defines += "#define MAX_NUM_MISSED_STEPS " + std::to_string(preset.maxMissedSteps) + '\n';
+    if (settings.gammaCorrect) defines += "#define GAMMA_CORRECT\n";
+    if (settings.useLightVolume) defines += "#define USE_LIGHT_VOLUME\n";
+    if (settings.useOccupancyGrid) defines += "#define USE_OCCUPANCY_GRID\n";
+    if (settings.farStepDistance > 0.f) defines += "#define FAR_STEP_DISTANCE " + std::to_string(settings.farStepDistance) + "f\n";
+    if (marchPass) defines += "#define CLOUD_MARCH_PASS\n";
+    return defines;
+}
+
+// Largest error the storage format itself adds to a density
+float volumeFormatTolerance() {
+    const auto &format = volumeFormatInfo();
+    if (format.unorm)  // half a quantization step
+        return .5f * (settings.unormDensityRange.y - settings.unormDensityRange.x) / 255.f + Worley::GPU_TOLERANCE;
+    if (format.internalFormat == GL_RGBA16F)  // 11-bit mantissa, densities stay below 2
+        return 1e-3f;
+    return Worley::GPU_TOLERANCE;
+}
+
+// Textures holding a volume: the RGBA texture, or the four channel textures of VOLUME_R8_CHANNELS
+std::vector<GLuint> volumeTextures(GLuint texSlot) {
+    if (volumeFormatInfo().splitChannels) {
+        const GLuint *channels = texSlot == 0 ? volumeTexHighResChannels : volumeTexLowResChannels;
+        return {channels, channels + 4};
+    }
+    return {texSlot == 0 ? volumeTexHighRes : volumeTexLowRes};
+}
+
+// Levels of the full mip chain of a dim^3 volume, down to 1^3
+int volumeMipLevels(int dim) {
+    int levels = 1;
+    while (dim >>= 1) levels++;
+    return levels;
+}
+
+// 3D density texture on textureUnit, repeating so the noise tiles, with room for its mip chain (generateVolumeMips)
+GLuint createVolumeTexture(GLenum textureUnit, int dim, GLenum internalFormat) {
+    GLuint volumeTex;
+    glGenTextures(1, &volumeTex);
+    glActiveTexture(textureUnit);
+    glBindTexture(GL_TEXTURE_3D, volumeTex);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexStorage3D(GL_TEXTURE_3D, volumeMipLevels(dim), internalFormat, dim, dim, dim);
+    return volumeTex;
+}
+
+// Volume textures (high and low res) in the current settings.volumeFormat, replacing any previous ones.
+// RGBA layouts live on units 0 and 1, the R8 channel textures on units 8-11 (high) and 12-15 (low).
+void allocateVolumeTextures() {
+    glDeleteTextures(1, &volumeTexHighRes);
+    glDeleteTextures(1, &volumeTexLowRes);
+    glDeleteTextures(4, volumeTexHighResChannels);
+    glDeleteTextures(4, volumeTexLowResChannels);
+    volumeTexHighRes = volumeTexLowRes = 0;
+    std::fill(std::begin(volumeTexHighResChannels), std::end(volumeTexHighResChannels), 0);
+    std::fill(std::begin(volumeTexLowResChannels), std::end(volumeTexLowResChannels), 0);
+
+    const auto &format = volumeFormatInfo();
+    const auto &dimHiRes = settings.hiResNoise.resolution;
+    const auto &dimLoRes = settings.loResNoise.resolution;
+    if (format.splitChannels) {
+        for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
+            volumeTexHighResChannels[channelIdx] = createVolumeTexture(GL_TEXTURE8 + channelIdx, dimHiRes, format.internalFormat);
+            volumeTexLowResChannels[channelIdx] = createVolumeTexture(GL_TEXTURE12 + channelIdx, dimLoRes, format.internalFormat);
+        }
+    } else {
+        volumeTexHighRes = createVolumeTexture(GL_TEXTURE0, dimHiRes, format.internalFormat);
+        volumeTexLowRes = createVolumeTexture(GL_TEXTURE1, dimLoRes, format.internalFormat);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Put the density volumes back on units 0/1 (8-15 when split), where the samplers point, ahead of a pass
+// that samples them: uploads and read-backs bind over whatever unit is active.
+void bindDensityVolumes() {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, volumeTexHighRes);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, volumeTexLowRes);
+    for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
+        glActiveTexture(GL_TEXTURE8 + channelIdx);
+        glBindTexture(GL_TEXTURE_3D, volumeTexHighResChannels[channelIdx]);
+        glActiveTexture(GL_TEXTURE12 + channelIdx);
+        glBindTexture(GL_TEXTURE_3D, volumeTexLowResChannels[channelIdx]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Compute all four channels of a volume in one dispatch of 8x8x8 tiles
+void dispatchWorleyTiled(GLuint texSlot) {
+    auto scope = m_profiler.scope("worley tiled");
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    const auto &format = volumeFormatInfo();
+
+    if (settings.hashWorleyPoints) {
+        glUseProgram(m_worleyTiledShader);
+        setNoiseSeedUniform(m_worleyTiledShader);
+    } else if (fitsWorleyPointBuffers(noiseParams)) {
+        updateWorleyPointsAllChannels(noiseParams);
+    } else {
+        return;
+    }
+
+    glm::ivec3 cellsPerAxis[4];
+    for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
+        const auto &worleyPointsParams = noiseParams.worleyPointsParams[channelIdx];
+        cellsPerAxis[channelIdx] = glm::ivec3(worleyPointsParams.cellsPerAxisFine,
+                                              worleyPointsParams.cellsPerAxisMedium,
+                                              worleyPointsParams.cellsPerAxisCoarse);
+    }
+
+    glUseProgram(m_worleyTiledShader);
+    glUniform1f(glGetUniformLocation(m_worleyTiledShader, "persistence"), noiseParams.persistence);
+    glUniform1i(glGetUniformLocation(m_worleyTiledShader, "volumeResolution"), noiseParams.resolution);
+    glUniform3iv(glGetUniformLocation(m_worleyTiledShader, "cellsPerAxis"), 4, glm::value_ptr(cellsPerAxis[0]));
+    glUniform2fv(glGetUniformLocation(m_worleyTiledShader, "unormDensityRange"), 1, glm::value_ptr(settings.unormDensityRange));
+    auto textures = volumeTextures(texSlot);
+    for (GLuint imageUnit = 0; imageUnit < textures.size(); imageUnit++)  // one per channel when split
+        glBindImageTexture(imageUnit, textures[imageUnit], 0, GL_TRUE, 0, GL_WRITE_ONLY, format.internalFormat);
+
+    const GLuint numTiles = (noiseParams.resolution + WORLEY_TILE_SIZE - 1) / WORLEY_TILE_SIZE;
+    glDispatchCompute(numTiles, numTiles, numTiles);
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+}
+
+// Compute one channel of a volume with worley.comb, leaving the other channels untouched
+void dispatchWorleyChannel(GLuint texSlot, int channelIdx) {
+    auto scope = m_profiler.scope("worley channel");
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    const auto &format = volumeFormatInfo();
+    if (!settings.hashWorleyPoints && !fitsWorleyPointBuffers(noiseParams)) return;
+
+    glUseProgram(m_worleyShader);
+    // pass uniforms
+    glUniform1f(glGetUniformLocation(m_worleyShader, "persistence"), noiseParams.persistence);
+    glUniform1i(glGetUniformLocation(m_worleyShader, "volumeResolution"), noiseParams.resolution);
+    glUniform2fv(glGetUniformLocation(m_worleyShader, "unormDensityRange"), 1, glm::value_ptr(settings.unormDensityRange));
+
+    auto textures = volumeTextures(texSlot);
+    const GLuint volumeTex = format.splitChannels ? textures[channelIdx] : textures[0];
+    glBindImageTexture(0, volumeTex, 0, GL_TRUE, 0, GL_READ_WRITE, format.internalFormat);
+
+    glm::vec4 channelMask(0.f);
+    channelMask[channelIdx] = 1.f;
+    glUniform4fv(glGetUniformLocation(m_worleyShader, "channelMask"), 1, glm::value_ptr(channelMask));
+
+    const auto &worleyPointsParams = noiseParams.worleyPointsParams[channelIdx];
+    if (settings.hashWorleyPoints)
+        setNoiseSeedUniform(m_worleyShader);
+    else
+        updateWorleyPoints(worleyPointsParams);  // generate new worley points into SSBO
+    glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisFine"), worleyPointsParams.cellsPerAxisFine);
+    glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisMedium"), worleyPointsParams.cellsPerAxisMedium);
+    glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisCoarse"), worleyPointsParams.cellsPerAxisCoarse);
+    glDispatchCompute(noiseParams.resolution, noiseParams.resolution, noiseParams.resolution);
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    lightVolumeDirty = true;
+    occupancyGridDirty = true;
+}
+
+// Fill the mip levels of a volume from level 0 with volumeMip.comb, each level from the one above it.
+// Run after anything writes level 0: the ray marcher samples the levels by distance, see sampleDensity.
+void generateVolumeMips(GLuint texSlot) {
+    auto scope = m_profiler.scope("volume mips");
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    const auto &format = volumeFormatInfo();
+    const int levels = volumeMipLevels(noiseParams.resolution);
+
+    glUseProgram(m_volumeMipShader);
+    glUniform1i(glGetUniformLocation(m_volumeMipShader, "source"), VOLUME_MIP_SOURCE_TEXTURE_UNIT);
+    glActiveTexture(GL_TEXTURE0 + VOLUME_MIP_SOURCE_TEXTURE_UNIT);
+    for (GLuint volumeTex : volumeTextures(texSlot)) {  // one per channel when split
+        glBindTexture(GL_TEXTURE_3D, volumeTex);
+        for (int level = 1; level < levels; level++) {
+            glUniform1i(glGetUniformLocation(m_volumeMipShader, "sourceLevel"), level - 1);
+            glBindImageTexture(0, volumeTex, level, GL_TRUE, 0, GL_WRITE_ONLY, format.internalFormat);
+            const int dim = std::max(noiseParams.resolution >> level, 1);
+            const GLuint numGroups = (dim + VOLUME_MIP_GROUP_SIZE - 1) / VOLUME_MIP_GROUP_SIZE;
+            glDispatchCompute(numGroups, numGroups, numGroups);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);  // the next level reads this one
+        }
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+}
+
+// Upload float densities into a volume, converting them to the storage format
+void uploadVolume(GLuint texSlot, const std::vector<glm::vec4> &volume) {
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    const auto &format = volumeFormatInfo();
+    const int dim = noiseParams.resolution;
+
+    std::vector<glm::vec4> encoded;
+    const std::vector<glm::vec4> *texels = &volume;
+    if (format.unorm) {  // the driver clamps floats to [0, 1] when converting to unorm
+        const auto range = settings.unormDensityRange;
+        encoded.resize(volume.size());
+        for (size_t i = 0; i < volume.size(); i++)
+            encoded[i] = (volume[i] - range.x) / (range.y - range.x);
+        texels = &encoded;
+    }
+
+    auto textures = volumeTextures(texSlot);
+    if (format.splitChannels) {
+        std::vector<float> channel(texels->size());
+        for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
+            for (size_t i = 0; i < channel.size(); i++)
+                channel[i] = (*texels)[i][channelIdx];
+            glBindTexture(GL_TEXTURE_3D, textures[channelIdx]);
+            glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dim, dim, dim, GL_RED, GL_FLOAT, channel.data());
+        }
+    } else {
+        glBindTexture(GL_TEXTURE_3D, textures[0]);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dim, dim, dim, GL_RGBA, GL_FLOAT, texels->data());
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+// Read a volume back from the GPU as float densities, undoing the storage format
+std::vector<glm::vec4> readBackVolume(GLuint texSlot) {
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    const auto &format = volumeFormatInfo();
+    const int dim = noiseParams.resolution;
+
+    std::vector<glm::vec4> volume(size_t(dim) * dim * dim);
+    auto textures = volumeTextures(texSlot);
+    if (format.splitChannels) {
+        std::vector<float> channel(volume.size());
+        for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
+            glBindTexture(GL_TEXTURE_3D, textures[channelIdx]);
+            glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, channel.data());
+            for (size_t i = 0; i < channel.size(); i++)
+                volume[i][channelIdx] = channel[i];
+        }
+    } else {
+        glBindTexture(GL_TEXTURE_3D, textures[0]);
+        glGetTexImage(GL_TEXTURE_3D, 0, GL_RGBA, GL_FLOAT, volume.data());
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    if (format.unorm) {
+        const auto range = settings.unormDensityRange;
+        for (auto &texel : volume)
+            texel = range.x + texel * (range.y - range.x);
+    }
+    return volume;
+}
+
+// Bake a whole volume (all four channels) with the CPU engine and upload it
+void bakeWorleyVolumeCPU(GLuint texSlot) {
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    uploadVolume(texSlot, Worley::createWorleyVolume3D(noiseParams.resolution, noiseParams.worleyPointsParams,
+                                                       noiseParams.persistence, settings.noiseSeed));
+}
+
+// Read back a GPU-baked volume and compare it against the CPU engine
+void validateWorleyVolumeCPU(GLuint texSlot) {
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    const int dim = noiseParams.resolution;
+
+    auto gpuVolume = readBackVolume(texSlot);
+    auto cpuVolume = Worley::createWorleyVolume3D(dim, noiseParams.worleyPointsParams, noiseParams.persistence, settings.noiseSeed);
+    float maxDiff = Worley::maxAbsDifference(cpuVolume, gpuVolume);
+    std::cout << "Worley volume " << texSlot << ": max |CPU - GPU| = " << maxDiff
+              << (maxDiff <= volumeFormatTolerance() ? " (ok)" : " (MISMATCH)") << '\n';
+}
+
+// Cache key of one texture of a volume (see volumeTextures),
+// including the source of the Worley shader that bakes it with the current settings
+uint64_t volumeCacheKey(GLuint texSlot, int textureIdx) {
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    const auto &format = volumeFormatInfo();
+    const char *shaderPath = settings.useTiledWorley ? "../Shaders/worleyTiled.comb" : "../Shaders/worley.comb";
+    return VolumeCache::makeKey(noiseParams, settings.noiseSeed, ShaderLoader::sourceText(shaderPath),
+                                format.internalFormat, format.splitChannels ? textureIdx : -1,
+                                format.unorm ? settings.unormDensityRange : glm::vec2(0.f, 1.f));
+}
+
+// How bakeWorleyVolume uses the on-disk cache
+enum class VolumeCacheUse {
+    LOAD,            // reuse an entry if there is one; a miss is not written back (interactive edits)
+    LOAD_AND_STORE,  // also write an entry on a miss (startup), a synchronous read-back and disk write
+};
+
+// Fill a whole volume: from the on-disk cache when possible, otherwise bake it
+void bakeWorleyVolume(GLuint texSlot, VolumeCacheUse cacheUse) {
+    const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
+    auto textures = volumeTextures(texSlot);
+
+    lightVolumeDirty = true;
+    occupancyGridDirty = true;
+    if (settings.useVolumeCache) {
+        bool loaded = true;
+        for (int textureIdx = 0; loaded && textureIdx < int(textures.size()); textureIdx++)
+            loaded = m_volumeCache.load(volumeCacheKey(texSlot, textureIdx), noiseParams.resolution, textures[textureIdx]);
+        if (loaded) {
+            std::cout << "Worley volume " << texSlot << ": loaded from " << m_volumeCache.pathFor(volumeCacheKey(texSlot, 0)) << '\n';
+            generateVolumeMips(texSlot);  // the cache holds level 0 only
+            return;
+        }
+    }
+
+    if (settings.bakeWorleyOnCPU) {
+        bakeWorleyVolumeCPU(texSlot);
+    } else if (settings.useTiledWorley) {
+        dispatchWorleyTiled(texSlot);  // all four channels in a single dispatch
+    } else {
+        for (int channelIdx = 0; channelIdx < 4; channelIdx++)
+            dispatchWorleyChannel(texSlot, channelIdx);
+    }
+
+    if (settings.validateWorleyOnCPU && !settings.bakeWorleyOnCPU)
+        validateWorleyVolumeCPU(texSlot);
+
+    const bool store = settings.useVolumeCache && cacheUse == VolumeCacheUse::LOAD_AND_STORE;
+    for (int textureIdx = 0; store && textureIdx < int(textures.size()); textureIdx++) {
+        if (!m_volumeCache.store(volumeCacheKey(texSlot, textureIdx), noiseParams.resolution, textures[textureIdx]))
+            std::cerr << "Worley volume " << texSlot << ": could not write cache entry" << std::endl;
+    }
+    generateVolumeMips(texSlot);
+}
+
+// (Re)compile the Worley and volume mip compute shaders for the current settings.volumeFormat
+void createWorleyPrograms() {
+    glDeleteProgram(m_worleyShader);
+    glDeleteProgram(m_worleyTiledShader);
+    glDeleteProgram(m_volumeMipShader);
+    m_worleyShader = ShaderLoader::createComputeShaderProgram("../Shaders/worley.comb", worleyDefines());
+    m_worleyTiledShader = ShaderLoader::createComputeShaderProgram("../Shaders/worleyTiled.comb", worleyDefines());
+    m_volumeMipShader = ShaderLoader::createComputeShaderProgram("../Shaders/volumeMip.comb", volumeFormatDefines());
+    if (m_shaderHotReload) {  // the volume format may have changed the defines
+        m_shaderHotReload->watch(&m_worleyShader, {{GL_COMPUTE_SHADER, "../Shaders/worley.comb"}}, worleyDefines());
+        m_shaderHotReload->watch(&m_worleyTiledShader, {{GL_COMPUTE_SHADER, "../Shaders/worleyTiled.comb"}}, worleyDefines());
+        m_shaderHotReload->watch(&m_volumeMipShader, {{GL_COMPUTE_SHADER, "../Shaders/volumeMip.comb"}}, volumeFormatDefines());
+    }
+}
+
+// Bake the hi-res volume in every storage format and print the error against the exact CPU volume,
+// the memory it takes, and GPU time of the bake and of a sampling pass shaped like sampleDensity
+void compareVolumeFormats() {
+    constexpr GLuint BENCH_NUM_RAYS = 64 * 1024;
+    constexpr int BENCH_NUM_STEPS = 64;
+
+    const int chosenFormat = settings.volumeFormat;
+    const auto &noiseParams = settings.hiResNoise;
+    const int dim = noiseParams.resolution;
+    auto reference = Worley::createWorleyVolume3D(dim, noiseParams.worleyPointsParams, noiseParams.persistence, settings.noiseSeed);
+
+    GLuint ssboBench, timerQuery;
+    glGenBuffers(1, &ssboBench);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboBench);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, BENCH_NUM_RAYS * sizeof(GLfloat), nullptr, GL_DYNAMIC_COPY);
+    glGenQueries(1, &timerQuery);
+    auto gpuMilliseconds = [&](auto &&work) {
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+        work();
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsed);
+        return elapsed * 1e-6;
+    };
+
+    std::cout << "Volume formats, " << dim << "^3 hi-res volume:\n"
+              << std::left << std::setw(10) << "format" << std::right << std::setw(10) << "MB"
+              << std::setw(12) << "max err" << std::setw(12) << "rms err"
+              << std::setw(12) << "bake ms" << std::setw(12) << "sample ms" << '\n';
+    for (int format = 0; format < VOLUME_FORMAT_COUNT; format++) {
+        settings.volumeFormat = format;
+        allocateVolumeTextures();
+        createWorleyPrograms();
+
+        double bakeMs = gpuMilliseconds([] {
+            if (settings.useTiledWorley) {
+                dispatchWorleyTiled(0);
+            } else {
+                for (int channelIdx = 0; channelIdx < 4; channelIdx++)
+                    dispatchWorleyChannel(0, channelIdx);
+            }
+        });
+
+        auto volume = readBackVolume(0);
+        double sumErr2 = 0.;
+        for (size_t i = 0; i < volume.size(); i++) {
+            glm::vec4 err = volume[i] - reference[i];
+            sumErr2 += glm::dot(err, err);
+        }
+        float maxErr = Worley::maxAbsDifference(reference, volume);
+        double rmsErr = std::sqrt(sumErr2 / (4. * volume.size()));
+
+        GLuint benchShader = ShaderLoader::createComputeShaderProgram("../Shaders/volumeSampleBench.comb", volumeFormatDefines());
+        glUseProgram(benchShader);
+        glUniform1i(glGetUniformLocation(benchShader, "numSteps"), BENCH_NUM_STEPS);
+        glUniform1i(glGetUniformLocation(benchShader, "volume"), 0);
+        for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
+            std::string name = "volumeChannels[" + std::to_string(channelIdx) + "]";
+            glUniform1i(glGetUniformLocation(benchShader, name.c_str()), 8 + channelIdx);
+        }
+        bindDensityVolumes();  // readBackVolume left the volume under test unbound
+        glDispatchCompute(BENCH_NUM_RAYS / 64, 1, 1);  // warm up caches and the driver
+        double sampleMs = gpuMilliseconds([] { glDispatchCompute(BENCH_NUM_RAYS / 64, 1, 1); });
+        glUseProgram(0);
+        glDeleteProgram(benchShader);
+
+        const double megabytes = double(dim) * dim * dim * VOLUME_FORMATS[format].bytesPerVoxel / (1024. * 1024.);
+        std::cout << std::left << std::setw(10) << VOLUME_FORMATS[format].name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(10) << megabytes
+                  << std::scientific << std::setprecision(2) << std::setw(12) << maxErr << std::setw(12) << rmsErr
+                  << std::fixed << std::setprecision(2) << std::setw(12) << bakeMs << std::setw(12) << sampleMs << '\n';
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+
+    glDeleteQueries(1, &timerQuery);
+    glDeleteBuffers(1, &ssboBench);
+
+    settings.volumeFormat = chosenFormat;
+    allocateVolumeTextures();
+    createWorleyPrograms();
+}
+
+// Samplers read by sampleDensity (Shaders/cloudDensity.glsl), for any program including it; program must be in use.
+// Its other inputs live in the RenderParams block, see updateRenderParams.
+void setDensitySamplers(GLuint program) {
+    // Density volumes, see allocateVolumeTextures
+    glUniform1i(glGetUniformLocation(program, "volumeHighRes"), 0);
+    glUniform1i(glGetUniformLocation(program, "volumeLowRes"), 1);
+    for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
+        std::string index = "[" + std::to_string(channelIdx) + "]";
+        glUniform1i(glGetUniformLocation(program, ("volumeHighResChannels" + index).c_str()), 8 + channelIdx);
+        glUniform1i(glGetUniformLocation(program, ("volumeLowResChannels" + index).c_str()), 12 + channelIdx);
+    }
+}
+
+// Uniforms of a default.frag variant that only change on resize, set when the variant is first built
+void initCloudProgram(GLuint program) {
+    setDensitySamplers(program);
+    glUniform1i(glGetUniformLocation(program, "lightVolume"), LIGHT_VOLUME_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "occupancyGrid"), OCCUPANCY_GRID_TEXTURE_UNIT);
+
+    // Camera
+    glUniform1f(glGetUniformLocation(program , "xMax"), m_camera.xMax());
+    glUniform1f(glGetUniformLocation(program , "yMax"), m_camera.yMax());
+    glUniform3fv(glGetUniformLocation(program, "rayOrigWorld"), 1, glm::value_ptr(m_camera.getPos()));
+    glUniformMatrix4fv(glGetUniformLocation(program, "viewInverse"), 1, GL_FALSE, glm::value_ptr(m_camera.getViewMatrixInverse()));
+
+    // Lighting
+//    glUniform1i(glGetUniformLocation(program, "numLights"), 0);
+    glUniform4fv(glGetUniformLocation(program, "phaseParams"), 1, glm::value_ptr(glm::vec4(0.83f, 0.3f, 0.8f, 0.15f))); // TODO: make it adjustable hyperparameters
+    glUniform1i(glGetUniformLocation(program, "nightColor"), 5);
+    glUniform1i(glGetUniformLocation(program, "sunGradient"), 4);
+    glUniform1i(glGetUniformLocation(program, "solidDepth"), 2);
+    glUniform1i(glGetUniformLocation(program, "solidColor"), 3);
+    glUniform1f(glGetUniformLocation(program, "near"), settings.nearPlane);
+    glUniform1f(glGetUniformLocation(program, "far"), settings.farPlane);
+    glUniform1i(glGetUniformLocation(program, "cloudBuffer"), CLOUD_BUFFER_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "skyViewLUT"), SKY_VIEW_LUT_TEXTURE_UNIT);
+}
+
+// Point the cloud programs at the variants for the current settings, building any that are new
+void selectCloudPrograms() {
+    m_volumeShader = m_cloudShaders.get(cloudDefines(false));
+    m_cloudMarchShader = m_cloudShaders.get(cloudDefines(true));
+    m_lightVolumeShader = m_lightVolumeShaders.get(densityDefines());
+    m_occupancyGridShader = m_occupancyGridShaders.get(densityDefines());
+}
+
+// Terrain uniforms set once, and again by resizeGL when the projection changes; program must be in use
+void initTerrainProgram(GLuint program) {
+    glm::mat4 projView = m_camera.getProjMatrix() * m_camera.getViewMatrix() * m_world;
+    glUniformMatrix4fv(glGetUniformLocation(program, "projViewMatrix"), 1, GL_FALSE, glm::value_ptr(projView));
+
+    glm::mat4 transInv = glm::transpose(glm::inverse(m_camera.getViewMatrix() * m_world));
+    glUniformMatrix4fv(glGetUniformLocation(program, "transInvViewMatrix"), 1, GL_FALSE, glm::value_ptr(transInv));
+
+    glUniform1i(glGetUniformLocation(program, "color_sampler"), 3);
+    glUniform1i(glGetUniformLocation(program, "height_sampler"), 6);
+    glUniform1i(glGetUniformLocation(program, "normal_sampler"), 7);
+    glUniform1i(glGetUniformLocation(program, "tileMaps"), TERRAIN_TILES_TEXTURE_UNIT);
+}
+
+void initCloudResolveProgram(GLuint program) {
+    glUniform1f(glGetUniformLocation(program, "xMax"), m_camera.xMax());
+    glUniform1f(glGetUniformLocation(program, "yMax"), m_camera.yMax());
+    glUniform3fv(glGetUniformLocation(program, "rayOrigWorld"), 1, glm::value_ptr(m_camera.getPos()));
+    glUniformMatrix4fv(glGetUniformLocation(program, "viewInverse"), 1, GL_FALSE, glm::value_ptr(m_camera.getViewMatrixInverse()));
+    glUniform1i(glGetUniformLocation(program, "cloudSamples"), CLOUD_SAMPLES_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "cloudSampleDepth"), CLOUD_SAMPLE_DEPTH_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "cloudHistory"), CLOUD_HISTORY_TEXTURE_UNIT);
+}
+
+void initUpsampleProgram(GLuint program) {
+    glUniform1i(glGetUniformLocation(program, "solidDepth"), 2);
+    glUniform1i(glGetUniformLocation(program, "solidColor"), 3);
+    glUniform1i(glGetUniformLocation(program, "cloudColor"), CLOUD_LOW_RES_TEXTURE_UNIT);
+    glUniform1f(glGetUniformLocation(program, "near"), settings.nearPlane);
+    glUniform1f(glGetUniformLocation(program, "far"), settings.farPlane);
+}
+
+// One uniform buffer for the settings every scene program reads, bound once for all of them
+void setUpRenderParams() {
+    glGenBuffers(1, &uboRenderParams);
+    glBindBuffer(GL_UNIFORM_BUFFER, uboRenderParams);
+    glBufferStorage(GL_UNIFORM_BUFFER, sizeof(RenderParams), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, RENDER_PARAMS_BINDING, uboRenderParams);
+    renderParamsDirty = true;
+}
+
+// Rewrite the block in one call, only after settingsChanged
+void updateRenderParams() {
+    if (!renderParamsDirty) return;
+    const RenderParams params = RenderParams::fromSettings(settings);
+    glBindBuffer(GL_UNIFORM_BUFFER, uboRenderParams);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(params), &params);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    renderParamsDirty = false;
+}
+
+// Everything the light-volume bake depends on besides the noise volumes themselves.
+// All members are 4 bytes wide so the struct has no padding and can be compared with memcmp.
+struct LightVolumeInputs {
+    float sunLongitude, sunLatitude;
+    glm::vec3 volumeScaling, volumeTranslate;
+    NoiseParams hiResNoise, loResNoise;
+    float densityMult, cloudLightAbsorptionMult, minLightTransmittance;
+    int numSteps, invertDensity, cubicErosion, volumeFormat;
+};
+
+LightVolumeInputs lightVolumeInputs;  // what the light volume was last baked with
+
+LightVolumeInputs currentLightVolumeInputs() {
+    LightVolumeInputs inputs;
+    std::memset(&inputs, 0, sizeof(inputs));
+    inputs.sunLongitude = settings.lightData.longitude;
+    inputs.sunLatitude = settings.lightData.latitude;
+    inputs.volumeScaling = settings.volumeScaling;
+    inputs.volumeTranslate = settings.volumeTranslate;
+    inputs.hiResNoise = settings.hiResNoise;
+    inputs.loResNoise = settings.loResNoise;
+    inputs.densityMult = settings.densityMult;
+    inputs.cloudLightAbsorptionMult = settings.cloudLightAbsorptionMult;
+    inputs.minLightTransmittance = settings.minLightTransmittance;
+    inputs.numSteps = settings.numSteps;
+    inputs.invertDensity = settings.invertDensity;
+    inputs.cubicErosion = settings.cubicErosion;
+    inputs.volumeFormat = settings.volumeFormat;
+    return inputs;
+}
+
+// Transmittance volume over the cloud box, sampled with clamping so the box edges do not wrap
+void allocateLightVolume() {
+    glDeleteTextures(1, &lightVolumeTex);
+    const int dim = settings.lightVolumeResolution;
+    glGenTextures(1, &lightVolumeTex);
+    glActiveTexture(GL_TEXTURE0 + LIGHT_VOLUME_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_3D, lightVolumeTex);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_R16F, dim, dim, dim);
+    glActiveTexture(GL_TEXTURE0);
+    lightVolumeDirty = true;
+}
+
+// Bake the sun transmittance of every light-volume voxel with lightVolume.comb
+void bakeLightVolume() {
+    auto scope = m_profiler.scope("light volume");
+    updateRenderParams();
+    bindDensityVolumes();
+    glUseProgram(m_lightVolumeShader);
+    glBindImageTexture(0, lightVolumeTex, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R16F);
+
+    const GLuint numGroups = (settings.lightVolumeResolution + LIGHT_VOLUME_GROUP_SIZE - 1) / LIGHT_VOLUME_GROUP_SIZE;
+    glDispatchCompute(numGroups, numGroups, numGroups);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glUseProgram(0);
+
+    lightVolumeInputs = currentLightVolumeInputs();
+    lightVolumeDirty = false;
+}
+
+// Rebake the light volume only if the sun, the density parameters or the noise volumes changed
+void updateLightVolume() {
+    if (!settings.useLightVolume) return;
+    LightVolumeInputs inputs = currentLightVolumeInputs();
+    if (lightVolumeDirty || std::memcmp(&inputs, &lightVolumeInputs, sizeof(inputs)) != 0)
+        bakeLightVolume();
+}
+
+// Everything the occupancy grid depends on besides the hi-res volume, compared with memcmp like LightVolumeInputs
+struct OccupancyGridInputs {
+    glm::vec3 volumeScaling, volumeTranslate;
+    NoiseParams hiResNoise;
+    glm::vec2 unormDensityRange;
+    int invertDensity, volumeFormat, densityMaxLod;
+};
+
+OccupancyGridInputs occupancyGridInputs;  // what the grid was last built with
+
+OccupancyGridInputs currentOccupancyGridInputs() {
+    OccupancyGridInputs inputs;
+    std::memset(&inputs, 0, sizeof(inputs));
+    inputs.volumeScaling = settings.volumeScaling;
+    inputs.volumeTranslate = settings.volumeTranslate;
+    inputs.hiResNoise = settings.hiResNoise;
+    inputs.unormDensityRange = settings.unormDensityRange;
+    inputs.invertDensity = settings.invertDensity;
+    inputs.volumeFormat = settings.volumeFormat;
+    inputs.densityMaxLod = settings.densityMaxLod;
+    return inputs;
+}
+
+// One byte per macro cell, fetched with texelFetch by the ray marcher
+void allocateOccupancyGrid() {
+    glDeleteTextures(1, &occupancyGridTex);
+    const int dim = settings.occupancyGridResolution;
+    glGenTextures(1, &occupancyGridTex);
+    glActiveTexture(GL_TEXTURE0 + OCCUPANCY_GRID_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_3D, occupancyGridTex);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_R8, dim, dim, dim);
+    glActiveTexture(GL_TEXTURE0);
+    occupancyGridDirty = true;
+}
+
+// Mark the macro cells where sampleDensity can be non-zero with occupancyGrid.comb
+void bakeOccupancyGrid() {
+    auto scope = m_profiler.scope("occupancy grid");
+    updateRenderParams();
+    bindDensityVolumes();
+    glUseProgram(m_occupancyGridShader);
+    glBindImageTexture(0, occupancyGridTex, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8);
+
+    const GLuint numGroups = (settings.occupancyGridResolution + OCCUPANCY_GRID_GROUP_SIZE - 1) / OCCUPANCY_GRID_GROUP_SIZE;
+    glDispatchCompute(numGroups, numGroups, numGroups);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glUseProgram(0);
+
+    occupancyGridInputs = currentOccupancyGridInputs();
+    occupancyGridDirty = false;
+}
+
+// Rebuild the grid only if the box, the hi-res noise or its volume changed
+void updateOccupancyGrid() {
+    if (!settings.useOccupancyGrid) return;
+    OccupancyGridInputs inputs = currentOccupancyGridInputs();
+    if (occupancyGridDirty || std::memcmp(&inputs, &occupancyGridInputs, sizeof(inputs)) != 0)
+        bakeOccupancyGrid();
+}
+
+GLuint makeSkyLUT(GLuint unit, GLenum internalFormat, glm::ivec2 size, GLint wrapS) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, size.x, size.y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glActiveTexture(GL_TEXTURE0);
+    return tex;
+}
+
+// The transmittance LUT only depends on the planet and atmosphere, bake it once (and when its shader is reloaded)
+void bakeTransmittanceLUT() {
+    glUseProgram(m_transmittanceLUTShader);
+    glBindImageTexture(0, transmittanceLUTTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((TRANSMITTANCE_LUT_SIZE.x + SKY_LUT_GROUP_SIZE - 1) / SKY_LUT_GROUP_SIZE,
+                      (TRANSMITTANCE_LUT_SIZE.y + SKY_LUT_GROUP_SIZE - 1) / SKY_LUT_GROUP_SIZE, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glUseProgram(0);
+    skyViewDirty = true;
+}
+
+void setUpSky() {
+    transmittanceLUTTex = makeSkyLUT(TRANSMITTANCE_LUT_TEXTURE_UNIT, GL_R32F, TRANSMITTANCE_LUT_SIZE, GL_CLAMP_TO_EDGE);
+    skyViewLUTTex = makeSkyLUT(SKY_VIEW_LUT_TEXTURE_UNIT, GL_RGBA16F, SKY_VIEW_LUT_SIZE, GL_REPEAT);  // azimuth wraps
+    bakeTransmittanceLUT();
+}
+
+// Bake in-scattered light and view optical depth for every direction around the camera
+void bakeSkyView() {
+    auto scope = m_profiler.scope("sky view");
+    glUseProgram(m_skyViewShader);
+    glUniform1i(glGetUniformLocation(m_skyViewShader, "transmittanceLUT"), TRANSMITTANCE_LUT_TEXTURE_UNIT);
+    glUniform3fv(glGetUniformLocation(m_skyViewShader, "rayOrigWorld"), 1, glm::value_ptr(m_camera.getPos()));
+    glUniform1f(glGetUniformLocation(m_skyViewShader, "sunLongitude"), settings.lightData.longitude);
+    glUniform1f(glGetUniformLocation(m_skyViewShader, "sunLatitude"), settings.lightData.latitude);
+    glBindImageTexture(0, skyViewLUTTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glDispatchCompute((SKY_VIEW_LUT_SIZE.x + SKY_LUT_GROUP_SIZE - 1) / SKY_LUT_GROUP_SIZE,
+                      (SKY_VIEW_LUT_SIZE.y + SKY_LUT_GROUP_SIZE - 1) / SKY_LUT_GROUP_SIZE, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glUseProgram(0);
+
+    skyViewSun = glm::vec2(settings.lightData.longitude, settings.lightData.latitude);
+    skyViewOrigin = glm::vec3(m_camera.getPos());
+    skyViewDirty = false;
+}
+
+// Rebake the sky-view LUT only if the sun or the camera moved
+void updateSkyView() {
+    const glm::vec2 sun(settings.lightData.longitude, settings.lightData.latitude);
+    if (skyViewDirty || sun != skyViewSun || glm::vec3(m_camera.getPos()) != skyViewOrigin)
+        bakeSkyView();
+}
+
 void setUpScreenQuad(){
     glGenBuffers(1, &vboScreenQuad);
     glBindBuffer(GL_ARRAY_BUFFER, vboScreenQuad);
@@ -96,35 +982,25 @@ void setUpScreenQuad(){
 }
 
 void setUpVolume(){
-    // SSBO for Worley points of three frequencies, with enough memory prealloced
-    glGenBuffers(1, &ssboWorley);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboWorley);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboWorley);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 3*WORLEY_MAX_NUM_POINTS * szVec4(), NULL, GL_STATIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-    // Volume textures (high and low res)
-    const auto &dimHiRes = settings.hiResNoise.resolution;
-    glGenTextures(1, &volumeTexHighRes);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_3D, volumeTexHighRes);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, dimHiRes, dimHiRes, dimHiRes, 0, GL_RGBA, GL_FLOAT, nullptr);
+    if (!settings.hashWorleyPoints) {  // hashed points are computed in the shaders
+        // SSBO for Worley points of three frequencies, with enough memory prealloced
+        glGenBuffers(1, &ssboWorley);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboWorley);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboWorley);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 3*WORLEY_MAX_NUM_POINTS * szVec4(), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        // SSBO for the tiled shader: three frequencies for each of the four channels
+        glGenBuffers(1, &ssboWorleyAllChannels);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboWorleyAllChannels);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboWorleyAllChannels);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 12*WORLEY_MAX_NUM_POINTS * szVec4(), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
 
-    const auto &dimLoRes = settings.loResNoise.resolution;
-    glGenTextures(1, &volumeTexLowRes);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_3D, volumeTexLowRes);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, dimLoRes, dimLoRes, dimLoRes, 0, GL_RGBA, GL_FLOAT, nullptr);
+    allocateVolumeTextures();
+    allocateLightVolume();
+    allocateOccupancyGrid();
 }
 
 void setUpTextures() {
@@ -166,16 +1042,166 @@ void setUpTextures() {
     // stbi_image_free(data);
 }
 
+// (Re)create the height, normal and color textures of the terrain at its resolution
+void allocateTerrainMaps() {
+    const int res = m_terrain.getResolution();
+    glDeleteTextures(1, &m_terrain_height_texture);
+    glDeleteTextures(1, &m_terrain_normal_texture);
+    glDeleteTextures(1, &m_terrain_color_texture);
+    glGenTextures(1, &m_terrain_height_texture);
+    glGenTextures(1, &m_terrain_normal_texture);
+    glGenTextures(1, &m_terrain_color_texture);
+
+    const std::pair<GLuint, GLenum> maps[] = {
+        {m_terrain_height_texture, GL_R32F}, {m_terrain_normal_texture, GL_RGBA32F}, {m_terrain_color_texture, GL_RGBA8}};
+    for (auto [texture, internalFormat] : maps) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, res, res);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Upload the maps TerrainGenerator built on the CPU, moving them out so its copies are freed.
+// Returns the heights, which the CDLOD node bounds still read.
+std::vector<float> uploadTerrainMaps() {
+    const int res = m_terrain.getResolution();
+    std::vector<float> heights = m_terrain.takeHeightMap();
+    const std::vector<float> normals = m_terrain.takeNormalMap();
+    const std::vector<float> colors = m_terrain.takeColorMap();
+    allocateTerrainMaps();
+    glBindTexture(GL_TEXTURE_2D, m_terrain_height_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, res, res, GL_RED, GL_FLOAT, heights.data());
+    glBindTexture(GL_TEXTURE_2D, m_terrain_normal_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, res, res, GL_RGB, GL_FLOAT, normals.data());
+    glBindTexture(GL_TEXTURE_2D, m_terrain_color_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, res, res, GL_RGB, GL_FLOAT, colors.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return heights;
+}
+
+// Fill the maps with terrainHeight.comb and terrainNormal.comb, only the gradient table is uploaded
+void generateTerrainMapsGPU(const Perlin &noise) {
+    const int res = m_terrain.getResolution();
+    allocateTerrainMaps();
+
+    const auto &gradient = noise.getGradient();
+    if (!ssboPerlinGradient)
+        glGenBuffers(1, &ssboPerlinGradient);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboPerlinGradient);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gradient.size() * sizeof(GLfloat), gradient.data(), GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PERLIN_GRADIENT_BINDING, ssboPerlinGradient);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GLint previousProgram;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    const GLuint numGroups = (res + TERRAIN_MAP_GROUP_SIZE - 1) / TERRAIN_MAP_GROUP_SIZE;
+    glUseProgram(m_terrainHeightShader);
+    glUniform1i(glGetUniformLocation(m_terrainHeightShader, "cellSize"), noise.getCellSize());
+    glUniform1i(glGetUniformLocation(m_terrainHeightShader, "latticeSize"), noise.getLatticeSize());
+    glUniform1i(glGetUniformLocation(m_terrainHeightShader, "octaves"), settings.terrainOctaves);
+    glUniform1f(glGetUniformLocation(m_terrainHeightShader, "lacunarity"), settings.terrainLacunarity);
+    glUniform1f(glGetUniformLocation(m_terrainHeightShader, "gain"), settings.terrainGain);
+    glUniform1i(glGetUniformLocation(m_terrainHeightShader, "octaveLatticeOffset"), Perlin::OCTAVE_LATTICE_OFFSET);
+    glBindImageTexture(0, m_terrain_height_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute(numGroups, numGroups, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glUseProgram(m_terrainNormalShader);
+    glBindImageTexture(0, m_terrain_height_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, m_terrain_normal_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glBindImageTexture(2, m_terrain_color_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glDispatchCompute(numGroups, numGroups, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glUseProgram(previousProgram);
+}
+
+// Read back a terrain map, `channels` floats per texel
+std::vector<float> readBackTerrainMap(GLuint texture, GLenum format, int channels) {
+    const int res = m_terrain.getResolution();
+    std::vector<float> map(size_t(res) * res * channels);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, format, GL_FLOAT, map.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return map;
+}
+
+// Compare the GPU maps against the ones TerrainGenerator built from the same lattice, which are used up
+void validateTerrainMapsCPU() {
+    auto maxAbsDifference = [](const std::vector<float> &a, const std::vector<float> &b) {
+        float maxDiff = 0.f;
+        for (size_t i = 0; i < std::min(a.size(), b.size()); i++)
+            maxDiff = std::max(maxDiff, std::abs(a[i] - b[i]));
+        return maxDiff;
+    };
+    const float heightDiff = maxAbsDifference(readBackTerrainMap(m_terrain_height_texture, GL_RED, 1), m_terrain.takeHeightMap());
+    const float normalDiff = maxAbsDifference(readBackTerrainMap(m_terrain_normal_texture, GL_RGB, 3), m_terrain.takeNormalMap());
+    std::cout << "Terrain maps: max |CPU - GPU| height = " << heightDiff << ", normal = " << normalDiff
+              << (heightDiff <= 1e-4f && normalDiff <= 1e-3f ? " (ok)" : " (MISMATCH)") << '\n';
+}
+
 void setUpTerrain() {
     // Generate and bind the VBO
     glGenBuffers(1, &m_terrain_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, m_terrain_vbo);
 
+    // Height, normal and color maps on the GPU or the CPU, both from the same random lattice
+    m_terrain.setMeshMode(TerrainMesh(settings.terrainMesh));
+    m_terrain.setOctaves(settings.terrainOctaves, settings.terrainLacunarity, settings.terrainGain);
+    m_terrain.setSeed(settings.noiseSeed);
+    Perlin noise(m_terrain.getCellSize(), m_terrain.getResolution(), settings.noiseSeed);
+    if (settings.generateTerrainOnGPU && !settings.validateTerrainOnCPU)
+        m_terrain.generateMesh();
+    else
+        m_terrain.generateTerrain(noise);  // the maps to upload, or the reference for the GPU ones
+    std::vector<float> uploadedHeights;  // CDLOD still needs them below
+    if (settings.generateTerrainOnGPU) {
+        generateTerrainMapsGPU(noise);
+        if (settings.validateTerrainOnCPU)
+            validateTerrainMapsCPU();
+    } else {
+        uploadedHeights = uploadTerrainMaps();
+    }
+
     // Put data into the VBO
-    m_terrain.generateTerrain();
+    const bool lod = m_terrain.getMeshMode() == TERRAIN_MESH_CDLOD;
+    const bool tiles = m_terrain.getMeshMode() == TERRAIN_MESH_TILES;
+    std::vector<float> coordMap;
+    std::vector<uint32_t> patchIndices;
+    if (lod) {
+        // A single unit patch, instanced over the quadtree nodes drawTerrain picks every frame.
+        // Its node bounds need the heights on the CPU, read back when they were made on the GPU.
+        const std::vector<float> heights = settings.generateTerrainOnGPU
+                                         ? readBackTerrainMap(m_terrain_height_texture, GL_RED, 1)
+                                         : std::move(uploadedHeights);
+        m_terrainLOD.build(heights, m_terrain.getResolution(), 1.f / 3,
+                           glm::vec2(m_terrain.getScaleX(), m_terrain.getScaleY()), settings.terrainPatchGrid);
+        TerrainLOD::buildPatchMesh(settings.terrainPatchGrid, coordMap, patchIndices);
+    } else if (tiles) {
+        // One vertex per tile texel, instanced over the resident tiles drawTerrain picks every frame
+        TerrainTiles::Params params;
+        params.resolution = m_terrain.getResolution();
+        params.cellSize = m_terrain.getCellSize();
+        params.octaves = settings.terrainOctaves;
+        params.lacunarity = settings.terrainLacunarity;
+        params.gain = settings.terrainGain;
+        params.seed = uint32_t(settings.noiseSeed ^ settings.noiseSeed >> 32);
+        params.radius = settings.terrainTileRadius;
+        params.capacity = settings.terrainTileCache;
+        params.uploadsPerFrame = settings.terrainTileUploadsPerFrame;
+        m_terrainTiles = std::make_unique<TerrainTiles>(params);
+        glActiveTexture(GL_TEXTURE0 + TERRAIN_TILES_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_terrainTiles->getTexture());
+        glActiveTexture(GL_TEXTURE0);
+        TerrainLOD::buildPatchMesh(params.resolution, coordMap, patchIndices);
+        glBindBuffer(GL_ARRAY_BUFFER, m_terrain_vbo);  // TerrainTiles binds and unbinds its own buffers
+    } else {
+        coordMap = m_terrain.takeCoordMap();  // only needed for the upload below
+    }
     glBufferData(GL_ARRAY_BUFFER,
-                 m_terrain.getCoordMap().size() * sizeof(GLfloat),
-                 m_terrain.getCoordMap().data(),
+                 coordMap.size() * sizeof(GLfloat),
+                 coordMap.data(),
                  GL_STATIC_DRAW);
 
     // Generate and bind the VAO, with our VBO currently bound
@@ -187,30 +1213,240 @@ void setUpTerrain() {
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat),
                              nullptr);
 
+    // Index buffer of the shared-vertex meshes, recorded in the VAO
+    const std::vector<uint32_t> indices = lod || tiles ? std::move(patchIndices) : m_terrain.takeIndices();
+    m_terrain_index_count = GLsizei(indices.size());
+    if (!indices.empty()) {
+        glGenBuffers(1, &m_terrain_ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_terrain_ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    }
+
+    // Patch origin, size and level (tiles: origin and layer), one per instance
+    if (lod || tiles) {
+        glGenBuffers(1, &m_terrain_patch_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, m_terrain_patch_vbo);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), nullptr);
+        glVertexAttribDivisor(1, 1);
+    }
+
     // Unbind
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 //Draw Terrain Function
 void drawTerrain() {
+    auto scope = m_profiler.scope("terrain");
     glUseProgram(m_terrainShader);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_1D, sunTexture);
 
     glBindVertexArray(m_terrain_vao);
-    int res = m_terrain.getResolution();
-    glDrawArrays(GL_TRIANGLES, 0, res*res*6 * m_terrain.getScaleX() * m_terrain.getScaleY());
+    glUniform1i(glGetUniformLocation(m_terrainShader, "useLOD"), m_terrain.getMeshMode() == TERRAIN_MESH_CDLOD);
+    glUniform1i(glGetUniformLocation(m_terrainShader, "useTiles"), m_terrain.getMeshMode() == TERRAIN_MESH_TILES);
+    switch (m_terrain.getMeshMode()) {
+        case TERRAIN_MESH_ARRAYS: {
+            int res = m_terrain.getResolution();
+            glDrawArrays(GL_TRIANGLES, 0, res*res*6 * m_terrain.getScaleX() * m_terrain.getScaleY());
+            break;
+        }
+        case TERRAIN_MESH_INDEXED:
+            glDrawElements(GL_TRIANGLES, m_terrain_index_count, GL_UNSIGNED_INT, nullptr);
+            break;
+        case TERRAIN_MESH_STRIP:
+            glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);  // 0xffffffff ends a row
+            glDrawElements(GL_TRIANGLE_STRIP, m_terrain_index_count, GL_UNSIGNED_INT, nullptr);
+            glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+            break;
+        case TERRAIN_MESH_CDLOD: {
+            // Patches for this camera, in the space of the terrain vertices (before m_world)
+            const glm::vec3 cameraPos = glm::inverse(m_world) * m_camera.getPos();
+            const glm::mat4 projView = m_camera.getProjMatrix() * m_camera.getViewMatrix() * m_world;
+            const float pixelsPerRadian = m_FBO->getFBOHeight() / (2 * m_camera.yMax());
+            m_terrainLOD.select(cameraPos, projView, pixelsPerRadian, settings.terrainPixelError);
+            const auto &patches = m_terrainLOD.getPatches();
+            glBindBuffer(GL_ARRAY_BUFFER, m_terrain_patch_vbo);
+            glBufferData(GL_ARRAY_BUFFER, patches.size() * sizeof(glm::vec4), patches.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            const auto &morphRanges = m_terrainLOD.getMorphRanges();
+            glUniform1i(glGetUniformLocation(m_terrainShader, "patchGrid"), m_terrainLOD.getPatchGrid());
+            glUniform3fv(glGetUniformLocation(m_terrainShader, "lodCameraPos"), 1, glm::value_ptr(cameraPos));
+            glUniform2fv(glGetUniformLocation(m_terrainShader, "morphRanges"), GLsizei(morphRanges.size()), glm::value_ptr(morphRanges[0]));
+            glUniform2fv(glGetUniformLocation(m_terrainShader, "terrainExtent"), 1, glm::value_ptr(m_terrainLOD.getExtent()));
+            glDrawElementsInstanced(GL_TRIANGLES, m_terrain_index_count, GL_UNSIGNED_INT, nullptr, GLsizei(patches.size()));
+            break;
+        }
+        case TERRAIN_MESH_TILES: {
+            // Streams tiles in around the camera, draws the ones already resident
+            const glm::vec3 cameraPos = glm::inverse(m_world) * m_camera.getPos();
+            const glm::mat4 projView = m_camera.getProjMatrix() * m_camera.getViewMatrix() * m_world;
+            m_terrainTiles->update(cameraPos, projView);
+            const auto &visible = m_terrainTiles->getVisibleTiles();
+            glBindBuffer(GL_ARRAY_BUFFER, m_terrain_patch_vbo);
+            glBufferData(GL_ARRAY_BUFFER, visible.size() * sizeof(glm::vec4), visible.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            glUniform1i(glGetUniformLocation(m_terrainShader, "tileResolution"), m_terrainTiles->getResolution());
+            glDrawElementsInstanced(GL_TRIANGLES, m_terrain_index_count, GL_UNSIGNED_INT, nullptr, GLsizei(visible.size()));
+            break;
+        }
+    }
     glBindVertexArray(0);
     glUseProgram(0);
 }
 
+// Resolution the cloud and sky shader runs at
+glm::ivec2 cloudRenderSize() {
+    const int downsample = settings.cloudDownsample;
+    return glm::ivec2((m_FBO->getFBOWidth() + downsample - 1) / downsample,
+                      (m_FBO->getFBOHeight() + downsample - 1) / downsample);
+}
+
+// cloudCheckerSize and cloudDownsample are 1, 2 or 4; anything else rounds down to one of them
+int clampBlockSize(int size) {
+    return size >= 4 ? 4 : size >= 2 ? 2 : 1;
+}
+
+// World-space width of a cloud pixel per unit of distance along its ray, for the marcher's mip selection
+float cloudPixelSpread() {
+    return 2.f * m_camera.yMax() / cloudRenderSize().y;
+}
+
+// Which pixel of each checkerSize x checkerSize block is marched on a frame.
+// Ordered-dither order, so consecutive frames land far apart and each pixel is refreshed once per cycle.
+glm::ivec2 checkerOffset(unsigned frame, int checkerSize) {
+    static constexpr int BAYER_2X2[4] = {0, 2, 3, 1};  // rank of pixel (x, y) at [y * size + x]
+    static constexpr int BAYER_4X4[16] = {0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5};
+    if (checkerSize != 2 && checkerSize != 4) return glm::ivec2(0);  // checkerSize 1 marches every pixel
+    const int *ranks = checkerSize == 4 ? BAYER_4X4 : BAYER_2X2;
+    const int rank = frame % (checkerSize * checkerSize);
+    for (int i = 0; i < checkerSize * checkerSize; i++) {
+        if (ranks[i] == rank) return glm::ivec2(i % checkerSize, i / checkerSize);
+    }
+    return glm::ivec2(0);
+}
+
+GLuint makeCloudTarget(GLenum internalFormat, int width, int height) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return tex;
+}
+
+void deleteCloudTargets() {
+    glDeleteFramebuffers(1, &cloudSampleFBO);
+    glDeleteFramebuffers(2, cloudHistoryFBO);
+    glDeleteTextures(1, &cloudSampleTex);
+    glDeleteTextures(1, &cloudSampleDepthTex);
+    glDeleteTextures(2, cloudHistoryTex);
+    cloudTargetsCheckerSize = 0;
+}
+
+// (Re)create the checkerboard sample targets and the two full-resolution history buffers
+void allocateCloudTargets(int width, int height) {
+    deleteCloudTargets();
+    const int checkerSize = settings.cloudCheckerSize;
+    const int sampleWidth = (width + checkerSize - 1) / checkerSize;
+    const int sampleHeight = (height + checkerSize - 1) / checkerSize;
+
+    cloudSampleTex = makeCloudTarget(GL_RGBA16F, sampleWidth, sampleHeight);
+    cloudSampleDepthTex = makeCloudTarget(GL_R32F, sampleWidth, sampleHeight);
+    glGenFramebuffers(1, &cloudSampleFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, cloudSampleFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, cloudSampleTex, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, cloudSampleDepthTex, 0);
+    const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+
+    glGenFramebuffers(2, cloudHistoryFBO);
+    for (int i = 0; i < 2; i++) {
+        cloudHistoryTex[i] = makeCloudTarget(GL_RGBA16F, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, cloudHistoryFBO[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, cloudHistoryTex[i], 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    cloudTargetsCheckerSize = checkerSize;
+    cloudTargetsSize = glm::ivec2(width, height);
+    cloudHistoryValid = false;
+}
+
+// March this frame's checkerboard pixels at reduced resolution, then reproject the rest from the history.
+// Leaves the resolved clouds in cloudHistoryTex[cloudHistoryIdx].
+void drawCloudsTemporal() {
+    const int width = cloudRenderSize().x;
+    const int height = cloudRenderSize().y;
+    if (cloudTargetsCheckerSize != settings.cloudCheckerSize || cloudTargetsSize != glm::ivec2(width, height))
+        allocateCloudTargets(width, height);
+
+    const int checkerSize = settings.cloudCheckerSize;
+    const glm::ivec2 offset = checkerOffset(frameIndex, checkerSize);
+    const int sampleWidth = (width + checkerSize - 1) / checkerSize;
+    const int sampleHeight = (height + checkerSize - 1) / checkerSize;
+    GLint targetFBO;  // the screen or m_cloudFBO
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+    glBindVertexArray(vaoScreenQuad);
+
+    // Checkerboard march
+    {
+        auto scope = m_profiler.scope("cloud march");
+        glBindFramebuffer(GL_FRAMEBUFFER, cloudSampleFBO);
+        glViewport(0, 0, sampleWidth, sampleHeight);
+        glUseProgram(m_cloudMarchShader);
+        glUniform1i(glGetUniformLocation(m_cloudMarchShader, "checkerSize"), checkerSize);
+        glUniform2iv(glGetUniformLocation(m_cloudMarchShader, "checkerOffset"), 1, glm::value_ptr(offset));
+        glUniform1i(glGetUniformLocation(m_cloudMarchShader, "frameIndex"), int(frameIndex));
+        glUniform2f(glGetUniformLocation(m_cloudMarchShader, "renderSize"), float(width), float(height));
+        glUniform1f(glGetUniformLocation(m_cloudMarchShader, "pixelSpread"), cloudPixelSpread());
+        glDrawArrays(GL_TRIANGLES, 0, screenQuadData.size() / 5);
+    }
+
+    // Resolve against last frame
+    {
+        auto scope = m_profiler.scope("cloud resolve");
+        cloudHistoryIdx = 1 - cloudHistoryIdx;
+        glBindFramebuffer(GL_FRAMEBUFFER, cloudHistoryFBO[cloudHistoryIdx]);
+        glViewport(0, 0, width, height);
+        glUseProgram(m_cloudResolveShader);
+        glActiveTexture(GL_TEXTURE0 + CLOUD_SAMPLES_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, cloudSampleTex);
+        glActiveTexture(GL_TEXTURE0 + CLOUD_SAMPLE_DEPTH_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, cloudSampleDepthTex);
+        glActiveTexture(GL_TEXTURE0 + CLOUD_HISTORY_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, cloudHistoryTex[1 - cloudHistoryIdx]);
+        glUniform1i(glGetUniformLocation(m_cloudResolveShader, "checkerSize"), checkerSize);
+        glUniform2iv(glGetUniformLocation(m_cloudResolveShader, "checkerOffset"), 1, glm::value_ptr(offset));
+        glUniform1i(glGetUniformLocation(m_cloudResolveShader, "historyValid"), cloudHistoryValid);
+        glUniformMatrix4fv(glGetUniformLocation(m_cloudResolveShader, "prevProjView"), 1, GL_FALSE, glm::value_ptr(prevProjView));
+        glDrawArrays(GL_TRIANGLES, 0, screenQuadData.size() / 5);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+    glActiveTexture(GL_TEXTURE0 + CLOUD_BUFFER_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, cloudHistoryTex[cloudHistoryIdx]);
+    glActiveTexture(GL_TEXTURE0);
+
+    prevProjView = m_camera.getProjView();
+    cloudHistoryValid = true;
+    frameIndex++;
+}
+
 //draw Volume function
 void drawVolume() {
+    auto scope = m_profiler.scope("clouds");
     glDisable(GL_DEPTH_TEST);  // disable depth test for volume rendering
-    glUseProgram(m_volumeShader);
-    
+
     // Bind depth texture to slot #2 and color to #3
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, m_FBO.get()->getFboDepthTexture());
@@ -221,6 +1457,16 @@ void drawVolume() {
 
     glActiveTexture(GL_TEXTURE5);
     glBindTexture(GL_TEXTURE_2D, nightTexture);
+    bindDensityVolumes();
+
+    const bool temporal = settings.cloudCheckerSize > 1;
+    if (temporal)
+        drawCloudsTemporal();
+
+    glUseProgram(m_volumeShader);
+    glUniform1i(glGetUniformLocation(m_volumeShader, "useCloudBuffer"), temporal);
+    glUniform1i(glGetUniformLocation(m_volumeShader, "upsampleSolid"), settings.cloudDownsample > 1);
+    glUniform1f(glGetUniformLocation(m_volumeShader, "pixelSpread"), cloudPixelSpread());
 
     // Draw screen quad
     glBindVertexArray(vaoScreenQuad);
@@ -235,9 +1481,87 @@ void drawVolume() {
 }
 
 
+// Joint-bilateral upsample of the reduced-resolution clouds onto the full-resolution terrain
+void drawCloudUpsample() {
+    auto scope = m_profiler.scope("cloud upsample");
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(m_upsampleShader);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, m_FBO->getFboDepthTexture());
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, m_FBO->getFboColorTexture());
+    glActiveTexture(GL_TEXTURE0 + CLOUD_LOW_RES_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, m_cloudFBO->getFboColorTexture());
+    glActiveTexture(GL_TEXTURE0);
+    m_cloudFBO->drawFullscreenQuad();
+    glUseProgram(0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+// Every program built from Shaders/ and what to redo once a rebuilt one replaces it.
+// The Worley programs are watched by createWorleyPrograms, whose defines depend on the volume format.
+void watchShaders() {
+    auto vertFrag = [](const char *vertex, const char *fragment) {
+        return ShaderHotReload::StageFiles{{GL_VERTEX_SHADER, vertex}, {GL_FRAGMENT_SHADER, fragment}};
+    };
+    auto compute = [](const char *path) { return ShaderHotReload::StageFiles{{GL_COMPUTE_SHADER, path}}; };
+
+    m_shaderHotReload->watch(&m_cloudShaders);
+    m_shaderHotReload->watch(&m_lightVolumeShaders);
+    m_shaderHotReload->watch(&m_occupancyGridShaders);
+    m_shaderHotReload->watch(&m_cloudResolveShader, vertFrag("../Shaders/default.vert", "../Shaders/cloudResolve.frag"),
+                             "", initCloudResolveProgram);
+    m_shaderHotReload->watch(&m_upsampleShader, vertFrag("../Shaders/default.vert", "../Shaders/bilateralUpsample.frag"),
+                             "", initUpsampleProgram);
+    m_shaderHotReload->watch(&m_transmittanceLUTShader, compute("../Shaders/transmittanceLUT.comb"));
+    m_shaderHotReload->watch(&m_skyViewShader, compute("../Shaders/skyView.comb"));
+    m_shaderHotReload->watch(&m_terrainHeightShader, compute("../Shaders/terrainHeight.comb"));
+    m_shaderHotReload->watch(&m_terrainNormalShader, compute("../Shaders/terrainNormal.comb"));
+    m_shaderHotReload->watch(&m_terrainShader, vertFrag("../Shaders/terrainGen.vert", "../Shaders/terrainGen.frag"),
+                             "", initTerrainProgram);
+    m_shaderHotReload->watch(&m_terrainTextureShader, vertFrag("../Shaders/terrain.vert", "../Shaders/terrain.frag"));
+}
+
+// Swap in shaders edited on disk and redo whatever their old versions baked
+void reloadChangedShaders() {
+    const std::vector<GLuint *> swapped = m_shaderHotReload->update();
+    if (swapped.empty()) return;
+    auto reloaded = [&](const GLuint *program) {
+        return std::find(swapped.begin(), swapped.end(), program) != swapped.end();
+    };
+
+    const GLuint lightVolumeShader = m_lightVolumeShader, occupancyGridShader = m_occupancyGridShader;
+    selectCloudPrograms();  // default.frag, lightVolume.comb and occupancyGrid.comb variants were swapped inside their maps
+    if (m_lightVolumeShader != lightVolumeShader)
+        lightVolumeDirty = true;
+    if (m_occupancyGridShader != occupancyGridShader)
+        occupancyGridDirty = true;
+    if (reloaded(&m_worleyShader) || reloaded(&m_worleyTiledShader)) {
+        for (GLuint texSlot : {0, 1})
+            bakeWorleyVolume(texSlot, VolumeCacheUse::LOAD);  // the key covers the edited source
+    } else if (reloaded(&m_volumeMipShader)) {
+        for (GLuint texSlot : {0, 1})
+            generateVolumeMips(texSlot);
+        occupancyGridDirty = true;
+    }
+    if (reloaded(&m_transmittanceLUTShader))
+        bakeTransmittanceLUT();
+    if (reloaded(&m_skyViewShader))
+        skyViewDirty = true;
+    updateLightVolume();
+    updateOccupancyGrid();
+    updateSkyView();
+    cloudHistoryValid = false;
+}
+
 void paintGL() {
+    m_profiler.newFrame();
+    updateRenderParams();  // no-op unless the settings changed
+    if (m_shaderHotReload)
+        reloadChangedShaders();
+
     // Render terrain color and depth to FBO textures
-//    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO.get()->getFbo());
+    m_FBO->bind();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glActiveTexture(GL_TEXTURE7);
     glBindTexture(GL_TEXTURE_2D, m_terrain_normal_texture);
@@ -247,15 +1571,31 @@ void paintGL() {
     glBindTexture(GL_TEXTURE_2D, m_terrain_color_texture);
     drawTerrain();
 
-   // Draw on main screen
-   glBindFramebuffer(GL_FRAMEBUFFER, m_FBO->getFbo());
     GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
         std::cerr << "Framebuffer incomplete: " << std::hex << fboStatus << std::endl;
         // Handle incomplete framebuffer case
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-   drawVolume();
+    m_FBO->unbind();
+
+    if (settings.cloudDownsample > 1) {
+        // Clouds and sky into the reduced target, then upsampled onto the terrain
+        const glm::ivec2 size = cloudRenderSize();
+        if (!m_cloudFBO) {
+            m_cloudFBO = std::make_unique<FBO>(0, size.x, size.y, GL_RGBA16F);
+            m_cloudFBO->makeFBO();
+        } else if (m_cloudFBO->getFBOWidth() != size.x || m_cloudFBO->getFBOHeight() != size.y) {
+            m_cloudFBO->resize(size.x, size.y);
+        }
+        m_cloudFBO->bind();
+        drawVolume();
+        m_cloudFBO->unbind();
+        glViewport(0, 0, m_FBO->getFBOWidth(), m_FBO->getFBOHeight());
+        drawCloudUpsample();
+    } else {
+        // Draw on main screen
+        drawVolume();
+    }
 
     // Clear things up
     glUseProgram(0);
@@ -264,87 +1604,30 @@ void paintGL() {
 
 // Changed setting 
 void settingsChanged() {
+    settings.cloudCheckerSize = clampBlockSize(settings.cloudCheckerSize);
+    settings.cloudDownsample = clampBlockSize(settings.cloudDownsample);
     if (!glInitialized) return;  // avoid gl calls before initialization finishes
 
-    
-    glUseProgram(m_terrainShader);
-    // Light
-    glUniform1f(glGetUniformLocation(m_terrainShader , "testLight.longitude"), settings.lightData.longitude);
-    glUniform1f(glGetUniformLocation(m_terrainShader , "testLight.latitude"), settings.lightData.latitude);
-    glUniform1i(glGetUniformLocation(m_terrainShader , "testLight.type"), settings.lightData.type);
-    glUniform3fv(glGetUniformLocation(m_terrainShader , "testLight.dir"), 1, glm::value_ptr(settings.lightData.dir));
-    glUniform3fv(glGetUniformLocation(m_terrainShader , "testLight.color"), 1, glm::value_ptr(settings.lightData.color));
-    glUniform4fv(glGetUniformLocation(m_terrainShader , "testLight.pos"), 1, glm::value_ptr(settings.lightData.pos));
-
-
-    glUseProgram(m_volumeShader);
+    renderParamsDirty = true;  // light, volume and noise params, rewritten before they are next read
+    selectCloudPrograms();     // flags and quality compiled into the ray marcher
 
-    // Volume
-    glUniform3fv(glGetUniformLocation(m_volumeShader, "volumeScaling"), 1, glm::value_ptr(settings.volumeScaling));
-    glUniform3fv(glGetUniformLocation(m_volumeShader, "volumeTranslate"), 1, glm::value_ptr(settings.volumeTranslate));
-    glUniform1i(glGetUniformLocation(m_volumeShader, "numSteps"), settings.numSteps);
-//        glUniform1f(glGetUniformLocation(m_volumeShader, "stepSize"), settings.stepSize);
-
-    // Render Params
-    glUniform1f(glGetUniformLocation(m_volumeShader, "densityMult"), settings.densityMult);
-    glUniform1i(glGetUniformLocation(m_volumeShader, "invertDensity"), settings.invertDensity);
-    glUniform1i(glGetUniformLocation(m_volumeShader, "gammaCorrect"), settings.gammaCorrect);
-    glUniform1f(glGetUniformLocation(m_volumeShader, "cloudLightAbsorptionMult"), settings.cloudLightAbsorptionMult);
-    glUniform1f(glGetUniformLocation(m_volumeShader, "minLightTransmittance"), settings.minLightTransmittance);
-
-    // Shape texture: hi-res
-    glUniform4fv(glGetUniformLocation(m_volumeShader , "hiResNoiseScaling"), 1, glm::value_ptr(settings.hiResNoise.scaling));
-    glUniform3fv(glGetUniformLocation(m_volumeShader, "hiResNoiseTranslate"), 1, glm::value_ptr(settings.hiResNoise.translate));
-    glUniform4fv(glGetUniformLocation(m_volumeShader, "hiResChannelWeights"), 1, glm::value_ptr(settings.hiResNoise.channelWeights));
-    glUniform1f(glGetUniformLocation(m_volumeShader , "hiResDensityOffset"), settings.hiResNoise.densityOffset);
-
-    // Detailed texture: low-res
-    glUniform1f(glGetUniformLocation(m_volumeShader , "loResNoiseScaling"), settings.loResNoise.scaling[0]);
-    glUniform3fv(glGetUniformLocation(m_volumeShader, "loResNoiseTranslate"), 1, glm::value_ptr(settings.loResNoise.translate));
-    glUniform4fv(glGetUniformLocation(m_volumeShader, "loResChannelWeights"), 1, glm::value_ptr(settings.loResNoise.channelWeights));
-    glUniform1f(glGetUniformLocation(m_volumeShader , "loResDensityWeight"), settings.loResNoise.densityWeight);
-
-    // Light
-    glUniform1f(glGetUniformLocation(m_volumeShader , "testLight.longitude"), settings.lightData.longitude);
-    glUniform1f(glGetUniformLocation(m_volumeShader , "testLight.latitude"), settings.lightData.latitude);
-    glUniform1i(glGetUniformLocation(m_volumeShader , "testLight.type"), settings.lightData.type);
-    glUniform3fv(glGetUniformLocation(m_volumeShader , "testLight.dir"), 1, glm::value_ptr(settings.lightData.dir));
-    glUniform3fv(glGetUniformLocation(m_volumeShader , "testLight.color"), 1, glm::value_ptr(settings.lightData.color));
-    glUniform4fv(glGetUniformLocation(m_volumeShader , "testLight.pos"), 1, glm::value_ptr(settings.lightData.pos));
-    std::cout << glm::to_string(settings.lightData.dir) << glm::to_string(settings.lightData.color) << '\n';
+    cloudHistoryValid = false;  // the clouds may look different now, don't blend in the old ones
 
     glUseProgram(m_worleyShader);
     auto newArray = settings.newFineArray || settings.newMediumArray || settings.newCoarseArray;
-    if (newArray) {
-        int texSlot = settings.curSlot;
-        int channelIdx = settings.curChannel;
-        std::cout << "check" << texSlot << " " << channelIdx << '\n';
-
-        // pass uniforms
-        const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
-        glUniform1f(glGetUniformLocation(m_worleyShader, "persistence"), noiseParams.persistence);
-        glUniform1i(glGetUniformLocation(m_worleyShader, "volumeResolution"), noiseParams.resolution);
-
-        const auto &volumeTex = texSlot == 0 ? volumeTexHighRes : volumeTexLowRes;
-        glBindImageTexture(0, volumeTex, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32F);
-
-
-        glm::vec4 channelMask(0.f);
-        channelMask[channelIdx] = 1.f;
-        glUniform4fv(glGetUniformLocation(m_worleyShader, "channelMask"), 1, glm::value_ptr(channelMask));
-
-        const auto &worleyPointsParams = noiseParams.worleyPointsParams[channelIdx];
-        std::cout << "ss" << worleyPointsParams.cellsPerAxisFine << '\n';
-        updateWorleyPoints(worleyPointsParams);  // generate new worley points into SSBO
-        glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisFine"), worleyPointsParams.cellsPerAxisFine);
-        glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisMedium"), worleyPointsParams.cellsPerAxisMedium);
-        glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisCoarse"), worleyPointsParams.cellsPerAxisCoarse);
-        glDispatchCompute(noiseParams.resolution, noiseParams.resolution, noiseParams.resolution);
-        glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    if (newArray && settings.useTiledWorley) {
+        bakeWorleyVolume(settings.curSlot, VolumeCacheUse::LOAD);  // regenerates every channel, or reuses a cached bake
+    } else if (newArray) {
+        dispatchWorleyChannel(settings.curSlot, settings.curChannel);
+        generateVolumeMips(settings.curSlot);
     }
 
     glUseProgram(0);
 
+    updateLightVolume();  // no-op unless the sun or the clouds changed
+    updateOccupancyGrid();  // no-op unless the clouds changed
+    updateSkyView();      // no-op unless the sun moved
+
     
 }
 
@@ -355,23 +1638,53 @@ void finish() {
     glDeleteBuffers(1, &vboVolume);
     glDeleteBuffers(1, &vboScreenQuad);
     glDeleteBuffers(1, &ssboWorley);
+    glDeleteBuffers(1, &ssboWorleyAllChannels);
     glDeleteVertexArrays(1, &vaoVolume);
     glDeleteVertexArrays(1, &vaoScreenQuad);
-    glDeleteProgram(m_volumeShader);
+    m_cloudShaders.clear();
     glDeleteProgram(m_worleyShader);
+    glDeleteProgram(m_worleyTiledShader);
+    glDeleteProgram(m_volumeMipShader);
     glDeleteTextures(1, &volumeTexHighRes);
     glDeleteTextures(1, &volumeTexLowRes);
+    glDeleteTextures(4, volumeTexHighResChannels);
+    glDeleteTextures(4, volumeTexLowResChannels);
+    glDeleteTextures(1, &lightVolumeTex);
+    m_lightVolumeShaders.clear();
+    glDeleteTextures(1, &occupancyGridTex);
+    m_occupancyGridShaders.clear();
+    deleteCloudTargets();
+    glDeleteProgram(m_cloudResolveShader);
+    glDeleteProgram(m_upsampleShader);
+    glDeleteTextures(1, &transmittanceLUTTex);
+    glDeleteTextures(1, &skyViewLUTTex);
+    glDeleteProgram(m_transmittanceLUTShader);
+    glDeleteProgram(m_skyViewShader);
+    glDeleteProgram(m_terrainHeightShader);
+    glDeleteProgram(m_terrainNormalShader);
+    glDeleteBuffers(1, &ssboPerlinGradient);
+    glDeleteBuffers(1, &uboRenderParams);
+    glDeleteTextures(1, &m_terrain_height_texture);
+    glDeleteTextures(1, &m_terrain_normal_texture);
+    glDeleteTextures(1, &m_terrain_color_texture);
+    glDeleteBuffers(1, &m_terrain_vbo);
+    glDeleteBuffers(1, &m_terrain_ebo);
+    glDeleteBuffers(1, &m_terrain_patch_vbo);
+    glDeleteVertexArrays(1, &m_terrain_vao);
+    m_terrainTiles.reset();
+    m_cloudFBO.reset();
+    m_shaderHotReload.reset();
+    m_profiler.release();
 }
 
-// Initialize OpenGL function
-void initializeGL(GLFWwindow* window){
+// Initialize OpenGL function, for a framebuffer of width x height (a window or runHeadless' pbuffer)
+void initializeGL(int width, int height){
     // Initialize GLEW
     glewExperimental = GL_TRUE;
     GLenum err = glewInit();
     if (err != GLEW_OK) {
         std::cerr << "Error initializing GLEW: " << glewGetErrorString(err) << std::endl;
-        glfwTerminate();
-        return ;
+        return;  // glInitialized stays false, the caller tears down its window or context
     }
     std::cout << "Initialized GLEW: Version " << glewGetString(GLEW_VERSION) << std::endl;
 
@@ -381,19 +1694,30 @@ void initializeGL(GLFWwindow* window){
     glCullFace(GL_BACK);
     glEnable(GL_DEPTH_TEST);
 
-    int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
     glViewport(0, 0, width, height);
 
     // ... Rest of your OpenGL initialization code ...
-    m_volumeShader = ShaderLoader::createShaderProgram("../Shaders/default.vert", "../Shaders/default.frag");
-    m_worleyShader = ShaderLoader::createComputeShaderProgram("../Shaders/worley.comb");
+    ShaderLoader::setBinaryCacheDir(settings.useShaderCache ? settings.shaderCacheDir : "");
+    if (settings.hotReloadShaders)
+        m_shaderHotReload = std::make_unique<ShaderHotReload>("../Shaders");
+    m_cloudShaders = ShaderPermutations("../Shaders/default.vert", "../Shaders/default.frag", initCloudProgram);
+    createWorleyPrograms();
+    m_lightVolumeShaders = ShaderPermutations::compute("../Shaders/lightVolume.comb", setDensitySamplers);
+    m_occupancyGridShaders = ShaderPermutations::compute("../Shaders/occupancyGrid.comb", setDensitySamplers);
+    m_cloudResolveShader = ShaderLoader::createShaderProgram("../Shaders/default.vert", "../Shaders/cloudResolve.frag");
+    m_upsampleShader = ShaderLoader::createShaderProgram("../Shaders/default.vert", "../Shaders/bilateralUpsample.frag");
+    m_transmittanceLUTShader = ShaderLoader::createComputeShaderProgram("../Shaders/transmittanceLUT.comb");
+    m_skyViewShader = ShaderLoader::createComputeShaderProgram("../Shaders/skyView.comb");
+    m_terrainHeightShader = ShaderLoader::createComputeShaderProgram("../Shaders/terrainHeight.comb");
+    m_terrainNormalShader = ShaderLoader::createComputeShaderProgram("../Shaders/terrainNormal.comb");
     m_terrainShader = ShaderLoader::createShaderProgram("../Shaders/terrainGen.vert", "../Shaders/terrainGen.frag");
     m_terrainTextureShader = ShaderLoader::createShaderProgram("../Shaders/terrain.vert", "../Shaders/terrain.frag");
 
+    setUpRenderParams();
     setUpScreenQuad();
     setUpVolume();
     setUpTextures();
+    setUpSky();
 
     /* Set up default camera */
     m_camera = Camera(SceneCameraData(), width, height, settings.nearPlane, settings.farPlane);
@@ -409,136 +1733,41 @@ void initializeGL(GLFWwindow* window){
         m_world = glm::translate(m_world, glm::vec3(-0.5, -0.5, 0));
         //m_world = glm::scale(m_world, glm::vec3(2, 2, 2));
 
-        glm::mat4 projView = m_camera.getProjMatrix() * m_camera.getViewMatrix() * m_world;
-        glUniformMatrix4fv(glGetUniformLocation(m_terrainShader, "projViewMatrix"), 1, GL_FALSE, glm::value_ptr(projView));
-
-        glm::mat4 transInv = glm::transpose(glm::inverse(m_camera.getViewMatrix() * m_world));
-        glUniformMatrix4fv(glGetUniformLocation(m_terrainShader, "transInvViewMatrix"), 1, GL_FALSE, glm::value_ptr(transInv));
-
-        glUniform1f(glGetUniformLocation(m_terrainShader , "testLight.longitude"), settings.lightData.longitude);
-        glUniform1f(glGetUniformLocation(m_terrainShader , "testLight.latitude"), settings.lightData.latitude);
-        glUniform1i(glGetUniformLocation(m_terrainShader , "testLight.type"), settings.lightData.type);
-        glUniform3fv(glGetUniformLocation(m_terrainShader , "testLight.dir"), 1, glm::value_ptr(settings.lightData.dir));
-        glUniform3fv(glGetUniformLocation(m_terrainShader , "testLight.color"), 1, glm::value_ptr(settings.lightData.color));
-        glUniform4fv(glGetUniformLocation(m_terrainShader , "testLight.pos"), 1, glm::value_ptr(settings.lightData.pos));
-
-        GLint color_texture_loc = glGetUniformLocation(m_terrainShader, "color_sampler");
-        glUniform1i(color_texture_loc, 3);
-        GLint height_texture_loc = glGetUniformLocation(m_terrainShader, "height_sampler");
-        glUniform1i(height_texture_loc, 6);
-        GLint normal_texture_loc = glGetUniformLocation(m_terrainShader, "normal_sampler");
-        glUniform1i(normal_texture_loc, 7);
-
-        // start height map modification
-        glGenTextures(1, &m_terrain_height_texture);
-        glActiveTexture(GL_TEXTURE6);
-        glBindTexture(GL_TEXTURE_2D, m_terrain_height_texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, m_terrain.getResolution(), m_terrain.getResolution(), 0, GL_RED, GL_FLOAT, m_terrain.getHeightMap().data());
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        // start normal map modification
-        glActiveTexture(GL_TEXTURE7);
-        glBindTexture(GL_TEXTURE_2D, m_terrain_normal_texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, m_terrain.getResolution(), m_terrain.getResolution(), 0, GL_RGB, GL_FLOAT, m_terrain.getNormalMap().data());
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        // start color map modification
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, m_terrain_color_texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_terrain.getResolution(), m_terrain.getResolution(), 0, GL_RGB, GL_FLOAT, m_terrain.getColorMap().data());
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        // end height map modification
+        initTerrainProgram(m_terrainShader);
     }
     // Runs above this fine, 
     glUseProgram(0);
     
-    /* Compute worley noise 3D textures */
-    glUseProgram(m_worleyShader);
-    for (GLuint texSlot : {0, 1}) {  // high and low res volumes
-        // pass uniforms
-        const auto &noiseParams = texSlot == 0 ? settings.hiResNoise : settings.loResNoise;
-        glUniform1f(glGetUniformLocation(m_worleyShader, "persistence"), noiseParams.persistence);
-        glUniform1i(glGetUniformLocation(m_worleyShader, "volumeResolution"), noiseParams.resolution);
-
-        const auto &volumeTex = texSlot == 0 ? volumeTexHighRes : volumeTexLowRes;
-        glBindImageTexture(0, volumeTex, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32F);
+    if (settings.compareVolumeFormats)
+        compareVolumeFormats();
 
-        for (int channelIdx = 0; channelIdx < 4; channelIdx++) {
-            glm::vec4 channelMask(0.f);
-            channelMask[channelIdx] = 1.f;
-            glUniform4fv(glGetUniformLocation(m_worleyShader, "channelMask"), 1, glm::value_ptr(channelMask));
-
-            const auto &worleyPointsParams = noiseParams.worleyPointsParams[channelIdx];
-            updateWorleyPoints(worleyPointsParams);  // generate new worley points into SSBO
-            glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisFine"), worleyPointsParams.cellsPerAxisFine);
-            glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisMedium"), worleyPointsParams.cellsPerAxisMedium);
-            glUniform1i(glGetUniformLocation(m_worleyShader, "cellsPerAxisCoarse"), worleyPointsParams.cellsPerAxisCoarse);
-            glDispatchCompute(noiseParams.resolution, noiseParams.resolution, noiseParams.resolution);
-            glMemoryBarrier(GL_ALL_BARRIER_BITS);
-        }
-    }
-    std::cout << "Hami yaha chau\n";
-    glUseProgram(m_volumeShader);
-    {
-        // Volume
-        glUniform3fv(glGetUniformLocation(m_volumeShader, "volumeScaling"), 1, glm::value_ptr(settings.volumeScaling));
-        glUniform3fv(glGetUniformLocation(m_volumeShader, "volumeTranslate"), 1, glm::value_ptr(settings.volumeTranslate));
-        glUniform1i(glGetUniformLocation(m_volumeShader, "numSteps"), settings.numSteps);
-//        glUniform1f(glGetUniformLocation(m_volumeShader, "stepSize"), settings.stepSize);
-        
-        // Noise
-        glUniform1f(glGetUniformLocation(m_volumeShader, "densityMult"), settings.densityMult);
-        glUniform1i(glGetUniformLocation(m_volumeShader, "invertDensity"), settings.invertDensity);
-        glUniform1i(glGetUniformLocation(m_volumeShader, "gammaCorrect"), settings.gammaCorrect);
-        // hi-res
-        glUniform4fv(glGetUniformLocation(m_volumeShader , "hiResNoiseScaling"), 1, glm::value_ptr(settings.hiResNoise.scaling));
-        glUniform3fv(glGetUniformLocation(m_volumeShader, "hiResNoiseTranslate"), 1, glm::value_ptr(settings.hiResNoise.translate));
-        glUniform4fv(glGetUniformLocation(m_volumeShader, "hiResChannelWeights"), 1, glm::value_ptr(settings.hiResNoise.channelWeights));
-        glUniform1f(glGetUniformLocation(m_volumeShader , "hiResDensityOffset"), settings.hiResNoise.densityOffset);
-        // lo-res
-        glUniform1f(glGetUniformLocation(m_volumeShader , "loResNoiseScaling"), settings.loResNoise.scaling[0]);
-        glUniform3fv(glGetUniformLocation(m_volumeShader, "loResNoiseTranslate"), 1, glm::value_ptr(settings.loResNoise.translate));
-        glUniform4fv(glGetUniformLocation(m_volumeShader, "loResChannelWeights"), 1, glm::value_ptr(settings.loResNoise.channelWeights));
-        glUniform1f(glGetUniformLocation(m_volumeShader , "loResDensityWeight"), settings.loResNoise.densityWeight);
-
-        // Camera
-        glUniform1f(glGetUniformLocation(m_volumeShader , "xMax"), m_camera.xMax());
-        glUniform1f(glGetUniformLocation(m_volumeShader , "yMax"), m_camera.yMax());
-        glUniform3fv(glGetUniformLocation(m_volumeShader, "rayOrigWorld"), 1, glm::value_ptr(m_camera.getPos()));
-        glUniformMatrix4fv(glGetUniformLocation(m_volumeShader, "viewInverse"), 1, GL_FALSE, glm::value_ptr(m_camera.getViewMatrixInverse()));
-
-        // Lighting
-//        glUniform1i(glGetUniformLocation(m_volumeShader, "numLights"), 0);
-        glUniform4fv(glGetUniformLocation(m_volumeShader, "phaseParams"), 1, glm::value_ptr(glm::vec4(0.83f, 0.3f, 0.8f, 0.15f))); // TODO: make it adjustable hyperparameters
-        glUniform1f(glGetUniformLocation(m_volumeShader , "testLight.longitude"), settings.lightData.longitude);
-        glUniform1f(glGetUniformLocation(m_volumeShader , "testLight.latitude"), settings.lightData.latitude);
-        glUniform1i(glGetUniformLocation(m_volumeShader , "testLight.type"), settings.lightData.type);
-        glUniform3fv(glGetUniformLocation(m_volumeShader , "testLight.dir"), 1, glm::value_ptr(settings.lightData.dir));
-        glUniform3fv(glGetUniformLocation(m_volumeShader , "testLight.color"), 1, glm::value_ptr(settings.lightData.color));
-        glUniform4fv(glGetUniformLocation(m_volumeShader , "testLight.pos"), 1, glm::value_ptr(settings.lightData.pos));
-        glUniform1i(glGetUniformLocation(m_volumeShader, "nightColor"), 5);
-        glUniform1i(glGetUniformLocation(m_volumeShader, "sunGradient"), 4);
-        glUniform1i(glGetUniformLocation(m_volumeShader, "solidDepth"), 2);
-        glUniform1i(glGetUniformLocation(m_volumeShader, "solidColor"), 3);
-        glUniform1f(glGetUniformLocation(m_volumeShader, "near"), settings.nearPlane);
-        glUniform1f(glGetUniformLocation(m_volumeShader, "far"), settings.farPlane);
-        std::cout<<settings.farPlane<<std::endl;
+    /* Compute worley noise 3D textures, or pull them from the on-disk cache */
+    m_volumeCache = VolumeCache(settings.volumeCacheDir);
+    for (GLuint texSlot : {0, 1}) {  // high and low res volumes
+        bakeWorleyVolume(texSlot, VolumeCacheUse::LOAD_AND_STORE);
     }
+    selectCloudPrograms();
+
+    glUseProgram(m_cloudResolveShader);
+    initCloudResolveProgram(m_cloudResolveShader);
+    glUseProgram(m_upsampleShader);
+    initUpsampleProgram(m_upsampleShader);
     glUseProgram(0);
 
+    if (m_shaderHotReload)
+        watchShaders();
+
+    /* Bake sun transmittance and occupancy over the cloud box for the ray marcher, and the sky for this sun */
+    updateLightVolume();
+    updateOccupancyGrid();
+    updateSkyView();
+
     // init FBO
-    m_FBO = std::make_unique<FBO>(2, width, height);
+    m_FBO = std::make_unique<FBO>(0, width, height);
     m_FBO.get()->makeFBO();
+    prevProjView = m_camera.getProjView();
 
-    std::cout << "checking errors in initializeGL...\n";
     Debug::checkOpenGLErrors();
-    std::cout << "checking done\n";
 
     glInitialized = true;
 }
@@ -561,28 +1790,275 @@ void resizeGL(GLFWwindow* window, int width, int height) {
     // Update FBO with the new size
     // Assuming you have a corresponding setup for FBO in GLFW
    
-    m_FBO.get()->deleteRenderBuffer();
-    m_FBO.get()->deleteDepthTexture();
-    m_FBO.get()->deleteColorTexture();
-    m_FBO.get()->deleteFrameBuffer();
     m_screen_width = width;
     m_screen_height = height;
-    m_FBO.get()->setFboWidth(m_screen_width);
-    m_FBO.get()->setFboHeight(m_screen_height);
-    m_FBO.get()->makeFBO();
+    m_FBO.get()->resize(m_screen_width, m_screen_height);  // the cloud targets follow on the next paintGL
+
+    auto setXMax = [](GLuint program) {  // Pass camera mat (proj * view)
+        glUseProgram(program);
+        glUniform1f(glGetUniformLocation(program , "xMax"), m_camera.xMax());
+    };
+    m_cloudShaders.forEach(setXMax);
+    setXMax(m_cloudResolveShader);
+    glUseProgram(0);
+}
+
+// F3 shows or hides the profiler overlay
+void keyPressed(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS)
+        settings.showProfiler = !settings.showProfiler;
+}
 
-    glUseProgram(m_volumeShader);  // Pass camera mat (proj * view)
-    glUniform1f(glGetUniformLocation(m_volumeShader , "xMax"), m_camera.xMax());
+
+// Push a moved camera into the programs that only receive it at creation, see initCloudProgram
+void cameraChanged() {
+    m_cloudShaders.forEach([](GLuint program) {
+        glUseProgram(program);
+        initCloudProgram(program);
+    });
+    glUseProgram(m_cloudResolveShader);
+    initCloudResolveProgram(m_cloudResolveShader);
+    glUseProgram(m_terrainShader);
+    initTerrainProgram(m_terrainShader);
     glUseProgram(0);
+    cloudHistoryValid = false;  // nothing to reproject from after a jump
+    updateSkyView();
 }
 
+// The profiler overlay over the finished frame, once the platform backend (GLFW, or none headless) began its frame
+void drawProfilerOverlay() {
+    auto scope = m_profiler.scope("overlay");
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui::NewFrame();
+    m_profiler.drawOverlay(settings.frameBudgetMs, settings.profileExportPath);
+    ImGui::Render();
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+}
+
+// Settings a benchmark script can set by name. Runtime ones are picked up by settingsChanged and can change
+// between shots; the others are only read during initializeGL and belong in the script's top-level settings.
+struct SettingOverride {
+    std::function<void(double)> assign;
+    bool runtime;
+};
+
+const std::map<std::string, SettingOverride> &settingOverrides() {
+    auto set = [](auto &field, bool runtime) {
+        return SettingOverride{[&field](double value) { field = std::remove_reference_t<decltype(field)>(value); }, runtime};
+    };
+    auto setBlockSize = [](int &field) {  // 1, 2 or 4 like settingsChanged enforces, see clampBlockSize
+        return SettingOverride{[&field](double value) { field = clampBlockSize(int(value)); }, true};
+    };
+    static const std::map<std::string, SettingOverride> overrides = {
+        {"sunLongitude", set(settings.lightData.longitude, true)},
+        {"sunLatitude", set(settings.lightData.latitude, true)},
+        {"densityMult", set(settings.densityMult, true)},
+        {"cloudLightAbsorptionMult", set(settings.cloudLightAbsorptionMult, true)},
+        {"minLightTransmittance", set(settings.minLightTransmittance, true)},
+        {"invertDensity", set(settings.invertDensity, true)},
+        {"cubicErosion", set(settings.cubicErosion, true)},
+        {"cloudQuality", set(settings.cloudQuality, true)},
+        {"gammaCorrect", set(settings.gammaCorrect, true)},
+        {"useLightVolume", set(settings.useLightVolume, true)},
+        {"useOccupancyGrid", set(settings.useOccupancyGrid, true)},
+        {"densityMaxLod", set(settings.densityMaxLod, true)},
+        {"farStepDistance", set(settings.farStepDistance, true)},
+        {"hiResDensityOffset", set(settings.hiResNoise.densityOffset, true)},
+        {"cloudCheckerSize", setBlockSize(settings.cloudCheckerSize)},
+        {"cloudDownsample", setBlockSize(settings.cloudDownsample)},
+        {"terrainPixelError", set(settings.terrainPixelError, true)},
+        {"showProfiler", set(settings.showProfiler, true)},
+        {"volumeFormat", set(settings.volumeFormat, false)},
+        {"useTiledWorley", set(settings.useTiledWorley, false)},
+        {"hashWorleyPoints", set(settings.hashWorleyPoints, false)},
+        {"useVolumeCache", set(settings.useVolumeCache, false)},
+        {"useShaderCache", set(settings.useShaderCache, false)},
+        {"hotReloadShaders", set(settings.hotReloadShaders, false)},
+        {"lightVolumeResolution", set(settings.lightVolumeResolution, false)},
+        {"occupancyGridResolution", set(settings.occupancyGridResolution, false)},
+        {"terrainMesh", set(settings.terrainMesh, false)},
+        {"terrainPatchGrid", set(settings.terrainPatchGrid, false)},
+        {"terrainOctaves", set(settings.terrainOctaves, false)},
+        {"generateTerrainOnGPU", set(settings.generateTerrainOnGPU, false)},
+        {"terrainTileRadius", set(settings.terrainTileRadius, false)},
+        {"noiseSeed", set(settings.noiseSeed, false)},
+    };
+    return overrides;
+}
+
+void applySettingOverrides(const Json &overrides, bool beforeInit) {
+    for (size_t i = 0; i < overrides.keys.size(); i++) {
+        const Json &value = overrides.items[i];
+        auto it = settingOverrides().find(overrides.keys[i]);
+        if (it == settingOverrides().end() || (value.type != Json::NUMBER && value.type != Json::BOOLEAN)) {
+            std::cerr << "Headless: ignoring setting " << overrides.keys[i] << std::endl;
+        } else if (!beforeInit && !it->second.runtime) {
+            std::cerr << "Headless: " << overrides.keys[i] << " only applies in the top-level settings" << std::endl;
+        } else {
+            it->second.assign(value.type == Json::BOOLEAN ? double(value.boolean) : value.number);
+        }
+    }
+}
+
+glm::vec3 jsonVec3(const Json *value, glm::vec3 fallback) {
+    if (!value || value->type != Json::ARRAY || value->items.size() != 3) return fallback;
+    return glm::vec3(value->items[0].number, value->items[1].number, value->items[2].number);
+}
+
+// The default framebuffer as a binary PPM, top row first
+void saveFramePPM(const std::string &path, int width, int height) {
+    std::vector<unsigned char> pixels(size_t(width) * height * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "P6\n" << width << ' ' << height << "\n255\n";
+    for (int y = height - 1; y >= 0; y--)
+        out.write(reinterpret_cast<const char *>(&pixels[size_t(y) * width * 3]), std::streamsize(width) * 3);
+}
+
+/* Render the shots of a JSON script offscreen and report their timings, e.g.
+ *
+ *   {"width": 640, "height": 360, "output": "../benchmark/", "budgetMs": 33,
+ *    "settings": {"terrainMesh": 3},
+ *    "shots": [{"name": "noon", "camera": {"pos": [0.5, 0.3, 2], "look": [0, 0, -1]},
+ *               "settings": {"sunLatitude": 1.2, "cloudQuality": 1}, "warmup": 2, "frames": 10}]}
+ *
+ * Top-level settings apply before initializeGL, per-shot ones through settingsChanged. Each measured frame is
+ * finished before the next starts, so its CPU time (paintGL) and GPU time (GL_TIME_ELAPSED around it) are not
+ * blurred by pipelining. Writes frames.csv, the profiler's passes.csv and trace.json, and <shot>.ppm of the last
+ * frame of every shot unless "save" is false. Returns 1 if any shot's mean GPU time exceeds budgetMs.
+ */
+int runHeadless(const std::string &scriptPath) {
+#ifdef HEADLESS_EGL
+    std::ifstream file(scriptPath);
+    if (!file) {
+        std::cerr << "Headless: cannot open " << scriptPath << std::endl;
+        return 2;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    Json script;
+    try {
+        script = Json::parse(text.str());
+    } catch (const std::runtime_error &e) {
+        std::cerr << scriptPath << ": " << e.what() << std::endl;
+        return 2;
+    }
+
+    const int width = int(script.getNumber("width", 1200));
+    const int height = int(script.getNumber("height", 800));
+    const std::string output = script.getString("output", "../benchmark/");
+    const double budgetMs = script.getNumber("budgetMs", 0.0);
+    settings.hotReloadShaders = false;  // nobody edits shaders during a benchmark
+    if (const Json *overrides = script.find("settings"))
+        applySettingOverrides(*overrides, true);
+
+    HeadlessContext context(width, height);
+    if (!context.isCurrent()) return 2;
+    initializeGL(width, height);
+    if (!glInitialized) return 2;
+
+    // "showProfiler" draws the overlay into the frames; there is no window, so only the GL backend is used
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGui::GetIO().DisplaySize = ImVec2(float(width), float(height));
+    ImGui_ImplOpenGL3_Init("#version 460");
+
+    std::error_code ec;
+    std::filesystem::create_directories(output, ec);
+    std::ofstream frameLog(output + "frames.csv", std::ios::trunc);
+    frameLog << "shot,frame,cpu_ms,gpu_ms\n";
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+
+    int exitCode = 0;
+    const Json *shots = script.find("shots");
+    for (size_t shotIdx = 0; shots && shotIdx < shots->items.size(); shotIdx++) {
+        const Json &shot = shots->items[shotIdx];
+        const std::string name = shot.getString("name", "shot" + std::to_string(shotIdx));
+        if (const Json *pose = shot.find("camera")) {
+            SceneCameraData cameraData;
+            cameraData.pos = glm::vec4(jsonVec3(pose->find("pos"), glm::vec3(cameraData.pos)), 1.f);
+            cameraData.look = glm::vec4(jsonVec3(pose->find("look"), glm::vec3(cameraData.look)), 0.f);
+            cameraData.up = glm::vec4(jsonVec3(pose->find("up"), glm::vec3(cameraData.up)), 0.f);
+            cameraData.heightAngle = pose->getNumber("heightAngle", cameraData.heightAngle);
+            m_camera = Camera(cameraData, width, height, settings.nearPlane, settings.farPlane);
+            cameraChanged();
+        }
+        if (const Json *overrides = shot.find("settings")) {
+            applySettingOverrides(*overrides, false);
+            settingsChanged();
+        }
+
+        const int warmup = int(shot.getNumber("warmup", 2));
+        const int frames = int(shot.getNumber("frames", 10));
+        std::vector<double> cpuTimes, gpuTimes;
+        for (int frame = 0; frame < warmup + frames; frame++) {
+            const auto start = std::chrono::steady_clock::now();
+            glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+            paintGL();
+            glEndQuery(GL_TIME_ELAPSED);
+            const double cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            GLuint64 gpuNs = 0;
+            glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &gpuNs);  // waits for the frame
+            if (settings.showProfiler)
+                drawProfilerOverlay();  // after the measurement, which covers the scene only
+            if (frame < warmup) continue;
+            cpuTimes.push_back(cpuMs);
+            gpuTimes.push_back(gpuNs * 1e-6);
+            frameLog << name << ',' << frame - warmup << ',' << cpuMs << ',' << gpuNs * 1e-6 << '\n';
+        }
+        if (shot.getBool("save", true))
+            saveFramePPM(output + name + ".ppm", width, height);
+
+        auto mean = [](const std::vector<double> &times) {
+            double sum = 0.0;
+            for (double t : times) sum += t;
+            return times.empty() ? 0.0 : sum / double(times.size());
+        };
+        auto percentile95 = [](std::vector<double> times) {
+            if (times.empty()) return 0.0;
+            std::sort(times.begin(), times.end());
+            return times[std::min(times.size() - 1, size_t(0.95 * double(times.size())))];
+        };
+        const double gpuMean = mean(gpuTimes);
+        std::cout << std::fixed << std::setprecision(2) << name << ": cpu " << mean(cpuTimes) << " ms (p95 "
+                  << percentile95(cpuTimes) << "), gpu " << gpuMean << " ms (p95 " << percentile95(gpuTimes) << ")";
+        if (budgetMs > 0.0 && gpuMean > budgetMs) {
+            std::cout << " over the " << budgetMs << " ms budget";
+            exitCode = 1;
+        }
+        std::cout << std::defaultfloat << std::endl;
+    }
+
+    m_profiler.exportCSV(output + "passes.csv");
+    m_profiler.exportTrace(output + "trace.json");
+    glDeleteQueries(1, &timerQuery);
+    finish();
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui::DestroyContext();
+    return exitCode;
+#else
+    std::cerr << "Headless mode is only in the EGL build (CMakeLists.txt, FINAL_GRAPHIC_HEADLESS): " << scriptPath << std::endl;
+    return 2;
+#endif
+}
+
+int main(int argc, char **argv) {
+    // --headless script.json: offscreen benchmark run instead of the window, see runHeadless
+    if (argc >= 3 && std::strcmp(argv[1], "--headless") == 0)
+        return runHeadless(argv[2]);
 
-int main() {
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW\n";
         return -1;
     }
 
+#ifdef GLEW_EGL
+    // This GLEW loads its entry points through EGL (see CMakeLists.txt), so the window needs an EGL context too
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#endif
     GLFWwindow* window = glfwCreateWindow(1200, 800, "GLFW Application", NULL, NULL);
     if (!window) {
         std::cerr << "Failed to create GLFW window\n";
@@ -592,8 +2068,21 @@ int main() {
 
     glfwMakeContextCurrent(window);
 
-    initializeGL(window);
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    initializeGL(width, height);
+    if (!glInitialized) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return -1;
+    }
 
+    // Profiler overlay
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    glfwSetKeyCallback(window, keyPressed);  // before the ImGui backend, which chains to it
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init("#version 460");
 
     while (!glfwWindowShouldClose(window)) {
         // Rendering commands go here
@@ -604,11 +2093,19 @@ int main() {
 
         paintGL();
 
+        if (settings.showProfiler) {
+            ImGui_ImplGlfw_NewFrame();
+            drawProfilerOverlay();
+        }
+
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
     finish();
     // Clean up
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
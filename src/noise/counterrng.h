@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glm.hpp>
+#include <cstdint>
+
+/* Counter-based random numbers (Philox4x32-10, Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3").
+ * The output is a pure function of a 128-bit counter and a 64-bit key, so any cell's random values can be
+ * computed on their own: on any thread, in any order, or in a shader with umulExtended. We use the
+ * counter for the lattice coordinates plus a stream id, and the key for the seed (Settings::noiseSeed).
+ */
+namespace CounterRNG {
+
+// Keeps the uses of one seed apart: the same cell gives unrelated values in different streams.
+// Streams fit in the low 8 bits; the rest of the word is free for a sub-stream, see subStream.
+enum Stream : uint32_t {
+    WORLEY_POINTS_3D = 1,
+    WORLEY_POINTS_2D = 2,
+    PERLIN_GRADIENT = 3,
+    TERRAIN_TILE_GRADIENT = 4,
+};
+
+inline glm::uvec4 philox4x32(glm::uvec4 counter, uint64_t seed) {
+    constexpr uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+    constexpr uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+    uint32_t k0 = uint32_t(seed), k1 = uint32_t(seed >> 32);
+    for (int round = 0; round < 10; round++) {
+        const uint64_t p0 = uint64_t(M0) * counter.x;
+        const uint64_t p1 = uint64_t(M1) * counter.z;
+        counter = glm::uvec4(uint32_t(p1 >> 32) ^ counter.y ^ k0, uint32_t(p1),
+                             uint32_t(p0 >> 32) ^ counter.w ^ k1, uint32_t(p0));
+        k0 += W0;
+        k1 += W1;
+    }
+    return counter;
+}
+
+inline uint32_t subStream(Stream stream, uint32_t index) { return uint32_t(stream) | index << 8; }
+
+// Four independent values for integer cell (x, y, z) of a stream; use the ones you need
+inline glm::uvec4 cell(uint32_t stream, int x, int y, int z, uint64_t seed) {
+    return philox4x32(glm::uvec4(uint32_t(x), uint32_t(y), uint32_t(z), stream), seed);
+}
+
+// Top 24 bits to a float in [0, 1): exact, and never 1 after rounding
+inline float toUnitFloat(uint32_t bits) { return float(bits >> 8) * (1.f / 16777216.f); }
+
+inline glm::vec4 toUnitFloat(glm::uvec4 bits) {
+    return glm::vec4(toUnitFloat(bits.x), toUnitFloat(bits.y), toUnitFloat(bits.z), toUnitFloat(bits.w));
+}
+
+}  // namespace CounterRNG
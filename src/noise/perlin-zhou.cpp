@@ -1,9 +1,14 @@
 #include "perlin-zhou.h"
-#include <random>
-#include <chrono>
-
-Perlin::Perlin(int cellSize, int noiseMapSize) :
-    cellSize(cellSize), noiseMapSize(noiseMapSize) {
+#include "counterrng.h"
+#include "../utils/threadpool.h"
+#include <cmath>
+#include <gtc/constants.hpp>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+Perlin::Perlin(int cellSize, int noiseMapSize, uint64_t seed) :
+    cellSize(cellSize), noiseMapSize(noiseMapSize), seed(seed) {
     perlinSize = std::ceil(noiseMapSize/cellSize);
     gradient = formGradient();
 }
@@ -20,14 +25,10 @@ std::vector<float> Perlin::formGradient() {
     int length = perlinSize * perlinSize * 2;
     std::vector<float> gradient(length);
 
-    std::mt19937_64 rng;
-    uint64_t timeSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    std::seed_seq ss{uint32_t(timeSeed & 0xffffffff), uint32_t(timeSeed>>32)};
-    rng.seed(ss);
-    std::uniform_real_distribution<float> U(0, glm::two_pi<float>());
-
     for (int i = 0; i < length; i += 2) {
-        float theta = U(rng);
+        const int point = i / 2;
+        const glm::uvec4 bits = CounterRNG::cell(CounterRNG::PERLIN_GRADIENT, point % perlinSize, point / perlinSize, 0, seed);
+        float theta = CounterRNG::toUnitFloat(bits.x) * glm::two_pi<float>();
         float x = std::sin(theta);
         float y = std::cos(theta);
         gradient[i] = x;
@@ -78,14 +79,91 @@ float Perlin::sample2D(float x, float y) {
 
 
 std::vector<float> Perlin::formNoiseMap() {
-    std::vector<float> noiseMap(noiseMapSize*noiseMapSize);
-    for (int r = 0; r < noiseMapSize; r++) {
-        for (int c = 0; c < noiseMapSize; c++) {
-            auto curVal = sample2D(1.0*r/cellSize, 1.0*c/cellSize);
-//            curVal = (curVal + 1) / 2 * 255.f; // convert to image
-            noiseMap[r*noiseMapSize+c] = curVal;
-        }
+    return formNoiseMap(1, 2.f, .5f);
+}
+
+/* Adds amplitude * noise(row, c) at the given frequency to out[c] for the whole row.
+ * The lattice wraps every perlinSize cells, latticeOffset shifts it so octaves don't share gradients.
+ */
+void Perlin::addRow(int row, float frequency, float amplitude, int latticeOffset, float *out) {
+    // x is shared by the whole row, only the column cells differ between samples
+    const float x = float(row * frequency) / float(cellSize);
+    const int cellX = int(std::floor(x));
+    const float fracX = x - cellX;
+    const int x0 = (cellX + latticeOffset) % perlinSize;
+    const int x1 = (x0 + 1) % perlinSize;
+    const float sx = curve(fracX);
+
+    int c = 0;
+#if defined(__AVX2__)
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 size = _mm256_set1_ps(float(perlinSize));
+    const __m256 wx0 = _mm256_set1_ps(fracX), wx1 = _mm256_set1_ps(fracX - 1);
+    const __m256 vsx = _mm256_set1_ps(sx);
+    const __m256i rowOffset0 = _mm256_set1_epi32(x0 * 2), rowOffset1 = _mm256_set1_epi32(x1 * 2);
+    const __m256 iota = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 step = _mm256_set1_ps(frequency / float(cellSize));
+    const __m256 invSize = _mm256_set1_ps(1.f / float(perlinSize));
+    for (; c + 8 <= noiseMapSize; c += 8) {
+        const __m256 y = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(float(c)), iota), step);
+        const __m256 cellY = _mm256_floor_ps(y);
+        const __m256 fracY = _mm256_sub_ps(y, cellY);
+        // (cellY + latticeOffset) mod perlinSize; the reciprocal can land one period short, hence the fix-up
+        const __m256 shifted = _mm256_add_ps(cellY, _mm256_set1_ps(float(latticeOffset)));
+        __m256 y0 = _mm256_sub_ps(shifted, _mm256_mul_ps(size, _mm256_floor_ps(_mm256_mul_ps(shifted, invSize))));
+        y0 = _mm256_sub_ps(y0, _mm256_and_ps(_mm256_cmp_ps(y0, size, _CMP_GE_OQ), size));
+        const __m256 y1p = _mm256_add_ps(y0, one);
+        const __m256 y1 = _mm256_blendv_ps(y1p, _mm256_setzero_ps(), _mm256_cmp_ps(y1p, size, _CMP_GE_OQ));
+        const __m256i col0 = _mm256_mullo_epi32(_mm256_cvtps_epi32(y0), _mm256_set1_epi32(perlinSize * 2));
+        const __m256i col1 = _mm256_mullo_epi32(_mm256_cvtps_epi32(y1), _mm256_set1_epi32(perlinSize * 2));
+
+        // gradient (wx, wy) of each corner, dotted with the offset to the sample
+        auto corner = [&](__m256i colOffset, __m256i rowOffset, __m256 vx, __m256 vy) {
+            const __m256i offset = _mm256_add_epi32(colOffset, rowOffset);
+            const __m256 gx = _mm256_i32gather_ps(gradient.data(), offset, 4);
+            const __m256 gy = _mm256_i32gather_ps(gradient.data() + 1, offset, 4);
+            return _mm256_add_ps(_mm256_mul_ps(gx, vx), _mm256_mul_ps(gy, vy));
+        };
+        const __m256 wy1 = _mm256_sub_ps(fracY, one);
+        const __m256 v00 = corner(col0, rowOffset0, wx0, fracY);
+        const __m256 v10 = corner(col0, rowOffset1, wx1, fracY);
+        const __m256 v01 = corner(col1, rowOffset0, wx0, wy1);
+        const __m256 v11 = corner(col1, rowOffset1, wx1, wy1);
+
+        const __m256 sy = _mm256_mul_ps(_mm256_mul_ps(fracY, fracY), _mm256_sub_ps(_mm256_set1_ps(3.f), _mm256_add_ps(fracY, fracY)));
+        const __m256 vx0 = _mm256_add_ps(v00, _mm256_mul_ps(vsx, _mm256_sub_ps(v10, v00)));
+        const __m256 vx1 = _mm256_add_ps(v01, _mm256_mul_ps(vsx, _mm256_sub_ps(v11, v01)));
+        const __m256 value = _mm256_add_ps(vx0, _mm256_mul_ps(sy, _mm256_sub_ps(vx1, vx0)));
+        _mm256_storeu_ps(out + c, _mm256_add_ps(_mm256_loadu_ps(out + c), _mm256_mul_ps(_mm256_set1_ps(amplitude), value)));
+    }
+#endif
+    for (; c < noiseMapSize; c++) {
+        const float y = float(c * frequency) / float(cellSize);
+        const int cellY = int(std::floor(y));
+        const float fracY = y - cellY;
+        const int y0 = (cellY + latticeOffset) % perlinSize;
+        const int y1 = (y0 + 1) % perlinSize;
+
+        float v00 = dot(x0, y0, fracX, fracY);
+        float v10 = dot(x1, y0, fracX - 1, fracY);
+        float v01 = dot(x0, y1, fracX, fracY - 1);
+        float v11 = dot(x1, y1, fracX - 1, fracY - 1);
+
+        float vx0 = lerp(v00, v10, sx);
+        float vx1 = lerp(v01, v11, sx);
+        out[c] += amplitude * lerp(vx0, vx1, curve(fracY));
     }
-    return noiseMap;
 }
 
+std::vector<float> Perlin::formNoiseMap(int octaves, float lacunarity, float gain) {
+    std::vector<float> noiseMap(noiseMapSize*noiseMapSize, 0.f);
+    ThreadPool::global().parallelFor(0, noiseMapSize, [&](int r) {
+        float frequency = 1.f, amplitude = 1.f;
+        for (int octave = 0; octave < octaves; octave++) {
+            addRow(r, frequency, amplitude, OCTAVE_LATTICE_OFFSET * octave, &noiseMap[size_t(r) * noiseMapSize]);
+            frequency *= lacunarity;
+            amplitude *= gain;
+        }
+    });
+    return noiseMap;
+}
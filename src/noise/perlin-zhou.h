@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glm.hpp>
+#include <cstdint>
 #include <vector>
 
 // DEBUG
@@ -12,14 +13,24 @@ class Perlin {
 
 private:
     int cellSize, perlinSize, noiseMapSize;
+    uint64_t seed;
     std::vector<float> gradient;
 
 public:
-    Perlin(int cellSize, int noiseMapSize);
-    std::vector<float> formGradient();
+    static constexpr int OCTAVE_LATTICE_OFFSET = 7;  // lattice shift between octaves, also used by terrainHeight.comb
+
+    Perlin(int cellSize, int noiseMapSize, uint64_t seed);
+    const std::vector<float> &getGradient() const { return gradient; }  // (x, y) per lattice point
+    int getCellSize() const { return cellSize; }
+    int getLatticeSize() const { return perlinSize; }
+    std::vector<float> formGradient();  // unit vector per lattice point, a function of (seed, point), see CounterRNG
     float sample2D(float x, float y);
     float dot(int cellX, int cellY, float vx, float vy);
     std::vector<float> formNoiseMap();
+    // fBm: octave i samples the lattice at lacunarity^i times the base frequency, weighted by gain^i.
+    // The map still tiles as long as lacunarity is an integer.
+    std::vector<float> formNoiseMap(int octaves, float lacunarity, float gain);
+    void addRow(int row, float frequency, float amplitude, int latticeOffset, float *out);
     float lerp(float a, float b, float t);
     float curve(float t);
 };
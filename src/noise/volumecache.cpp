@@ -0,0 +1,216 @@
+#include "volumecache.h"
+#include "../utils/hash.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+constexpr char CACHE_MAGIC[4] = {'C', 'V', 'O', 'L'};
+
+// Pixel transfer format/type and texel size used to store each supported internal format
+struct TexelLayout {
+    GLenum format;
+    GLenum type;
+    size_t bytes;
+};
+
+bool texelLayout(GLenum internalFormat, TexelLayout &layout) {
+    switch (internalFormat) {
+        case GL_RGBA32F: layout = {GL_RGBA, GL_FLOAT, 4 * sizeof(GLfloat)}; return true;
+        case GL_RGBA16F: layout = {GL_RGBA, GL_HALF_FLOAT, 4 * sizeof(GLhalf)}; return true;
+        case GL_RGBA8:   layout = {GL_RGBA, GL_UNSIGNED_BYTE, 4}; return true;
+        case GL_R8:      layout = {GL_RED, GL_UNSIGNED_BYTE, 1}; return true;
+        default: return false;
+    }
+}
+
+// Read-only view of a whole file, unmapped when it goes out of scope
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return;
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data) size = size_t(fileSize.QuadPart);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+        void *ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) return;
+        data = ptr;
+        size = size_t(st.st_size);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap(data, size);
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const unsigned char *bytes() const { return static_cast<const unsigned char *>(data); }
+    size_t getSize() const { return size; }
+
+private:
+    void *data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Binds a 3D texture on the active unit and puts back whatever was bound there when it goes out of scope,
+// so a cache transfer leaves the caller's bindings as they were
+class ScopedTexture3D {
+public:
+    explicit ScopedTexture3D(GLuint texture) {
+        glGetIntegerv(GL_TEXTURE_BINDING_3D, &previous);
+        glBindTexture(GL_TEXTURE_3D, texture);
+    }
+
+    ~ScopedTexture3D() { glBindTexture(GL_TEXTURE_3D, GLuint(previous)); }
+
+    ScopedTexture3D(const ScopedTexture3D &) = delete;
+    ScopedTexture3D &operator=(const ScopedTexture3D &) = delete;
+
+private:
+    GLint previous = 0;
+};
+
+}  // namespace
+
+
+VolumeCache::VolumeCache(std::string directory) : directory(std::move(directory)) {}
+
+uint64_t VolumeCache::makeKey(const NoiseParams &noiseParams, uint64_t seed, const std::string &generatorSource,
+                              GLenum internalFormat, int channel, glm::vec2 unormRange) {
+    Fnv1a hash;
+    hash.add(VERSION);
+    hash.add(noiseParams.resolution);
+    for (const auto &worleyPointsParams : noiseParams.worleyPointsParams) {
+        hash.add(worleyPointsParams.cellsPerAxisFine);
+        hash.add(worleyPointsParams.cellsPerAxisMedium);
+        hash.add(worleyPointsParams.cellsPerAxisCoarse);
+    }
+    hash.add(noiseParams.persistence);
+    hash.add(seed);
+    hash.add(uint32_t(internalFormat));
+    hash.add(channel);
+    hash.add(unormRange.x);
+    hash.add(unormRange.y);
+    hash.add(generatorSource.data(), generatorSource.size());
+    return hash.value;
+}
+
+std::string VolumeCache::pathFor(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "volume_%016llx.bin", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(directory) / name).string();
+}
+
+bool VolumeCache::load(uint64_t key, int resolution, GLuint volumeTex) const {
+    MappedFile file(pathFor(key));
+    if (file.getSize() < sizeof(Header)) return false;  // missing or truncated
+
+    Header header;
+    std::memcpy(&header, file.bytes(), sizeof(Header));
+    TexelLayout layout;
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != VERSION
+        || header.key != key || header.resolution != resolution || !texelLayout(header.internalFormat, layout)) {
+        return false;
+    }
+    const uint64_t expectedBytes = uint64_t(resolution) * resolution * resolution * layout.bytes;
+    if (header.dataBytes != expectedBytes || file.getSize() - sizeof(Header) < expectedBytes) return false;
+
+    // Hand the mapped pages to the driver through a PBO; glTexSubImage3D then reads from the buffer
+    GLuint pbo;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(expectedBytes), file.bytes() + sizeof(Header), GL_STREAM_DRAW);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    {
+        ScopedTexture3D binding(volumeTex);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, resolution, resolution, resolution, header.format, header.type, nullptr);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &pbo);
+    return true;
+}
+
+bool VolumeCache::store(uint64_t key, int resolution, GLuint volumeTex) const {
+    ScopedTexture3D binding(volumeTex);
+    TexelLayout layout;
+    GLint internalFormat = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+    if (!texelLayout(GLenum(internalFormat), layout)) return false;
+
+    Header header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = VERSION;
+    header.key = key;
+    header.resolution = resolution;
+    header.internalFormat = uint32_t(internalFormat);
+    header.format = layout.format;
+    header.type = layout.type;
+    header.dataBytes = uint64_t(resolution) * resolution * resolution * layout.bytes;
+
+    std::vector<unsigned char> texels(header.dataBytes);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_3D, 0, layout.format, layout.type, texels.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    // Write next to the final name and rename, so a crash never leaves a half-written entry behind
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    const std::string path = pathFor(key);
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "VolumeCache: cannot write " << tmpPath << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+        out.write(reinterpret_cast<const char *>(texels.data()), std::streamsize(texels.size()));
+        if (!out) return false;
+    }
+    std::filesystem::rename(tmpPath, path, ec);
+    return !ec;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#ifdef __APPLE__
+#define GL_SILENCE_DEPRECATION
+#endif
+#include <GL/glew.h>
+#include <cstdint>
+#include <string>
+#include "../setting.h"
+
+/* On-disk cache of baked noise volumes.
+ * One file per volume, named after a hash of everything that affects its contents,
+ * so a changed NoiseParams simply misses and bakes a new entry.
+ * File layout: | Header | texels as glTexImage3D expects them (x fastest) |
+ */
+class VolumeCache {
+public:
+    // Bump whenever the file layout or the noise generator output changes
+    static constexpr uint32_t VERSION = 2;  // 2: Worley points from CounterRNG (Philox) instead of mt19937_64
+
+    struct Header {
+        char magic[4];            // "CVOL"
+        uint32_t version;
+        uint64_t key;
+        int32_t resolution;
+        uint32_t internalFormat;  // e.g. GL_RGBA32F
+        uint32_t format;          // pixel transfer format and type of the payload
+        uint32_t type;
+        uint64_t dataBytes;
+    };
+
+    explicit VolumeCache(std::string directory = "../cache/");
+
+    // Hash of resolution, Worley cell counts, persistence, RNG seed, storage format and generatorSource,
+    // the text of the compute shader that bakes the volume, so an edited shader misses instead of loading stale texels.
+    // channel picks one texture of a per-channel layout (-1 for RGBA textures);
+    // unormRange is the density range remapped into unorm formats.
+    static uint64_t makeKey(const NoiseParams &noiseParams, uint64_t seed, const std::string &generatorSource,
+                            GLenum internalFormat = GL_RGBA32F, int channel = -1,
+                            glm::vec2 unormRange = glm::vec2(0.f, 1.f));
+
+    // Upload a cached volume into volumeTex (already allocated) straight from the mapped file
+    // through a pixel-unpack buffer. Returns false on a miss or a stale/corrupt entry.
+    bool load(uint64_t key, int resolution, GLuint volumeTex) const;
+
+    // Read volumeTex back from the GPU and write it as the entry for key.
+    // Neither call disturbs the 3D texture bound on the active unit.
+    bool store(uint64_t key, int resolution, GLuint volumeTex) const;
+
+    std::string pathFor(uint64_t key) const;
+
+private:
+    std::string directory;
+};
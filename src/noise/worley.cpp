@@ -1,6 +1,11 @@
 #include "worley.h"
-#include <random>
-#include <chrono>
+#include "counterrng.h"
+#include "../utils/threadpool.h"
+#include <cmath>
+#include <limits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 
 inline auto pos3DToIndex(auto x, auto y, auto z, auto xDim, auto yDim) {
@@ -26,31 +31,25 @@ inline glm::vec2 indexToPos2D(auto index, auto xDim) {
 /* Generate (cellsPerAxis x cellsPerAxis x cellsPerAxis)
  * stratified random position samples in [0, 1]^3
  */
-std::vector<glm::vec4> Worley::createWorleyPointArray3D(size_t cellsPerAxis) {
-
-    // initialize U(0, 1)
-    std::mt19937_64 rng;
-//    uint64_t timeSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    uint64_t timeSeed = 42;
-    std::seed_seq ss{uint32_t(timeSeed & 0xffffffff), uint32_t(timeSeed>>32)};
-    rng.seed(ss);
-    std::uniform_real_distribution<float> U(0, 1);
-
+std::vector<glm::vec4> Worley::createWorleyPointArray3D(size_t cellsPerAxis, uint64_t seed) {
+    const int n = int(cellsPerAxis);
+    const uint32_t stream = CounterRNG::subStream(CounterRNG::WORLEY_POINTS_3D, uint32_t(n));
     std::vector<glm::vec4> arr(cellsPerAxis * cellsPerAxis * cellsPerAxis);
     float cellSize = 1.f / cellsPerAxis;
 
-    for (int z = 0; z < cellsPerAxis; z++) {
-        for (int y = 0; y < cellsPerAxis; y++) {
-            for (int x = 0; x < cellsPerAxis; x++) {
-                glm::vec3 offset(U(rng), U(rng), U(rng));
+    // Cells are independent, so z slabs can go to any worker in any order
+    ThreadPool::global().parallelFor(0, n, [&](int z) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                glm::vec3 offset = CounterRNG::toUnitFloat(CounterRNG::cell(stream, x, y, z, seed));
                 auto cellPos = (glm::vec3(x, y, z) + offset) * cellSize;
-                auto index = pos3DToIndex(x, y, z, cellsPerAxis, cellsPerAxis);
+                auto index = pos3DToIndex(x, y, z, n, n);
                 // Append 1 for field alignment
                 // https://stackoverflow.com/questions/38172696/should-i-ever-use-a-vec3-inside-of-a-uniform-buffer-or-shader-storage-buffer-o
                 arr[index] = {cellPos, 1.f};
             }
         }
-    }
+    });
 
     return arr;
 }
@@ -58,26 +57,183 @@ std::vector<glm::vec4> Worley::createWorleyPointArray3D(size_t cellsPerAxis) {
 /* Generate (cellsPerAxis x cellsPerAxis)
  * stratified random position samples in [0, 1]^2
  */
-std::vector<glm::vec2> Worley::createWorleyPointArray2D(size_t cellsPerAxis) {
-
-    // initialize U(0, 1)
-    std::mt19937_64 rng;
-    uint64_t timeSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    std::seed_seq ss{uint32_t(timeSeed & 0xffffffff), uint32_t(timeSeed>>32)};
-    rng.seed(ss);
-    std::uniform_real_distribution<float> U(0, 1);
-
+std::vector<glm::vec2> Worley::createWorleyPointArray2D(size_t cellsPerAxis, uint64_t seed) {
+    const int n = int(cellsPerAxis);
+    const uint32_t stream = CounterRNG::subStream(CounterRNG::WORLEY_POINTS_2D, uint32_t(n));
     std::vector<glm::vec2> arr(cellsPerAxis * cellsPerAxis);
     float cellSize = 1.f / cellsPerAxis;
 
-    for (int y = 0; y < cellsPerAxis; y++) {
-        for (int x = 0; x < cellsPerAxis; x++) {
-            glm::vec2 offset(U(rng), U(rng));
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            glm::vec2 offset = CounterRNG::toUnitFloat(CounterRNG::cell(stream, x, y, 0, seed));
             auto cellPos = (glm::vec2(x, y) + offset) * cellSize;
-            auto index = pos2DToIndex(x, y, cellsPerAxis);
+            auto index = pos2DToIndex(x, y, n);
             arr[index] = cellPos;
         }
     }
 
     return arr;
 }
+
+
+namespace {
+
+// One layer (fine, medium or coarse) of Worley points, as the compute shader sees it in the SSBO
+struct WorleyLayer {
+    const float *points;  // xyzw per cell, x-fastest
+    int cellsPerAxis;
+};
+
+// Wrap a cell id from [-1..n] into [0..n) and report the position shift that goes with it
+inline int wrapCell(int adjID, int n, float &shift) {
+    shift = adjID == -1 ? -1.f : (adjID == n ? 1.f : 0.f);
+    return (adjID + n) % n;
+}
+
+// Same as sampleWorleyDensity() in worley.comb, for a single voxel
+float sampleWorleyDensity(const glm::vec3 &position, const WorleyLayer &layer) {
+    const int n = layer.cellsPerAxis;
+    const glm::ivec3 cellID = glm::ivec3(position * float(n));
+
+    float minDist2 = 1.f;
+    for (int ox = -1; ox <= 1; ox++) {
+        for (int oy = -1; oy <= 1; oy++) {
+            for (int oz = -1; oz <= 1; oz++) {
+                glm::vec3 shift;
+                const int wx = wrapCell(cellID.x + ox, n, shift.x);
+                const int wy = wrapCell(cellID.y + oy, n, shift.y);
+                const int wz = wrapCell(cellID.z + oz, n, shift.z);
+                const float *point = layer.points + 4 * pos3DToIndex(wx, wy, wz, n, n);
+                const glm::vec3 adjPosition = glm::vec3(point[0], point[1], point[2]) + shift;
+                const glm::vec3 d = position - adjPosition;
+                minDist2 = std::min(minDist2, glm::dot(d, d));
+            }
+        }
+    }
+
+    return std::sqrt(minDist2) * n;
+}
+
+#if defined(__AVX2__)
+// Eight neighbouring voxels along x at once. y and z are shared by the whole row,
+// so only the x cell ids differ between lanes and the feature points are gathered per lane.
+__m256 sampleWorleyDensity8(__m256 px, float py, float pz, const WorleyLayer &layer) {
+    const int n = layer.cellsPerAxis;
+    const __m256i vn = _mm256_set1_epi32(n);
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256i cellX = _mm256_cvttps_epi32(_mm256_mul_ps(px, _mm256_set1_ps(float(n))));
+    const int cellY = int(py * float(n));
+    const int cellZ = int(pz * float(n));
+
+    __m256 minDist2 = one;
+    for (int ox = -1; ox <= 1; ox++) {
+        const __m256i adjX = _mm256_add_epi32(cellX, _mm256_set1_epi32(ox));
+        const __m256i under = _mm256_cmpgt_epi32(_mm256_setzero_si256(), adjX);     // adjX == -1
+        const __m256i over = _mm256_cmpgt_epi32(adjX, _mm256_set1_epi32(n - 1));    // adjX == n
+        __m256i wrappedX = _mm256_add_epi32(adjX, _mm256_and_si256(under, vn));
+        wrappedX = _mm256_sub_epi32(wrappedX, _mm256_and_si256(over, vn));
+        const __m256 shiftX = _mm256_sub_ps(_mm256_and_ps(_mm256_castsi256_ps(over), one),
+                                            _mm256_and_ps(_mm256_castsi256_ps(under), one));
+
+        for (int oy = -1; oy <= 1; oy++) {
+            float shiftY;
+            const int wy = wrapCell(cellY + oy, n, shiftY);
+            for (int oz = -1; oz <= 1; oz++) {
+                float shiftZ;
+                const int wz = wrapCell(cellZ + oz, n, shiftZ);
+
+                const __m256i index = _mm256_add_epi32(wrappedX, _mm256_set1_epi32(n * (wy + n * wz)));
+                const __m256i offset = _mm256_slli_epi32(index, 2);  // 4 floats per point
+                const __m256 gx = _mm256_i32gather_ps(layer.points + 0, offset, 4);
+                const __m256 gy = _mm256_i32gather_ps(layer.points + 1, offset, 4);
+                const __m256 gz = _mm256_i32gather_ps(layer.points + 2, offset, 4);
+
+                const __m256 dx = _mm256_sub_ps(px, _mm256_add_ps(gx, shiftX));
+                const __m256 dy = _mm256_sub_ps(_mm256_set1_ps(py), _mm256_add_ps(gy, _mm256_set1_ps(shiftY)));
+                const __m256 dz = _mm256_sub_ps(_mm256_set1_ps(pz), _mm256_add_ps(gz, _mm256_set1_ps(shiftZ)));
+                const __m256 dist2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                                   _mm256_mul_ps(dz, dz));
+                minDist2 = _mm256_min_ps(minDist2, dist2);
+            }
+        }
+    }
+
+    return _mm256_mul_ps(_mm256_sqrt_ps(minDist2), _mm256_set1_ps(float(n)));
+}
+#endif
+
+// Density of one layer for every voxel of row (y, z)
+void sampleWorleyRow(const WorleyLayer &layer, int y, int z, int resolution, float *out) {
+    const float res = float(resolution);
+    const float py = float(y) / res;
+    const float pz = float(z) / res;
+
+    int x = 0;
+#if defined(__AVX2__)
+    const __m256i iota = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (; x + 8 <= resolution; x += 8) {
+        const __m256 px = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), iota)),
+                                        _mm256_set1_ps(res));
+        _mm256_storeu_ps(out + x, sampleWorleyDensity8(px, py, pz, layer));
+    }
+#endif
+    for (; x < resolution; x++)
+        out[x] = sampleWorleyDensity(glm::vec3(float(x) / res, py, pz), layer);
+}
+
+}  // namespace
+
+/* Bake the full RGBA Worley volume on the CPU.
+ * Matches the compute shader voxel for voxel: same point arrays, same 27-cell search and
+ * the same persistence weighting of the coarse/medium/fine layers.
+ */
+std::vector<glm::vec4> Worley::createWorleyVolume3D(int resolution,
+                                                    const WorleyPointsParams (&worleyPointsParams)[4],
+                                                    float persistence, uint64_t seed) {
+    // Three layers per channel, exactly what updateWorleyPoints() uploads before each dispatch
+    std::vector<std::vector<glm::vec4>> pointArrays;
+    WorleyLayer layers[4][3];
+    for (int channel = 0; channel < 4; channel++) {
+        const auto &params = worleyPointsParams[channel];
+        const int cellsPerAxis[3] = {params.cellsPerAxisFine, params.cellsPerAxisMedium, params.cellsPerAxisCoarse};
+        for (int layer = 0; layer < 3; layer++) {
+            pointArrays.push_back(createWorleyPointArray3D(cellsPerAxis[layer], seed));
+            layers[channel][layer] = {&pointArrays.back()[0].x, cellsPerAxis[layer]};
+        }
+    }
+
+    std::vector<glm::vec4> volume(size_t(resolution) * resolution * resolution);
+    const float totalWeight = 1.f + persistence + persistence * persistence;
+
+    ThreadPool::global().parallelFor(0, resolution, [&](int z) {
+        std::vector<float> fine(resolution), medium(resolution), coarse(resolution);
+        for (int y = 0; y < resolution; y++) {
+            glm::vec4 *row = &volume[pos3DToIndex(size_t(0), size_t(y), size_t(z), size_t(resolution), size_t(resolution))];
+            for (int channel = 0; channel < 4; channel++) {
+                sampleWorleyRow(layers[channel][0], y, z, resolution, fine.data());
+                sampleWorleyRow(layers[channel][1], y, z, resolution, medium.data());
+                sampleWorleyRow(layers[channel][2], y, z, resolution, coarse.data());
+                for (int x = 0; x < resolution; x++) {
+                    float densityWeighted = coarse[x]
+                                          + medium[x] * persistence
+                                          + fine[x]   * persistence * persistence;
+                    row[x][channel] = densityWeighted / totalWeight;
+                }
+            }
+        }
+    });
+
+    return volume;
+}
+
+float Worley::maxAbsDifference(const std::vector<glm::vec4> &a, const std::vector<glm::vec4> &b) {
+    if (a.size() != b.size())
+        return std::numeric_limits<float>::infinity();
+
+    float maxDiff = 0.f;
+    for (size_t i = 0; i < a.size(); i++) {
+        glm::vec4 diff = glm::abs(a[i] - b[i]);
+        maxDiff = std::max(maxDiff, std::max(std::max(diff.x, diff.y), std::max(diff.z, diff.w)));
+    }
+    return maxDiff;
+}
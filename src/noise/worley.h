@@ -1,7 +1,9 @@
 #pragma once
 
 #include <glm.hpp>
+#include <cstdint>
 #include <vector>
+#include "../setting.h"
 
 // DEBUG
 #include <iostream>
@@ -12,6 +14,21 @@
 class Worley {
 
 public:
-    static std::vector<glm::vec2> createWorleyPointArray2D(size_t sideLength);
-    static std::vector<glm::vec4> createWorleyPointArray3D(size_t sideLength);
+    // One jittered point per cell; the jitter of each cell only depends on (seed, cell, sideLength),
+    // see CounterRNG, so the same seed and params always give the same volume
+    static std::vector<glm::vec2> createWorleyPointArray2D(size_t sideLength, uint64_t seed);
+    static std::vector<glm::vec4> createWorleyPointArray3D(size_t sideLength, uint64_t seed);
+
+    // CPU counterpart of Shaders/worley.comb: fills all four RGBA channels of a
+    // (resolution x resolution x resolution) volume, laid out x-fastest like glTexImage3D.
+    // Z slabs are spread over the global thread pool; rows use AVX2 lanes when available.
+    static std::vector<glm::vec4> createWorleyVolume3D(int resolution,
+                                                       const WorleyPointsParams (&worleyPointsParams)[4],
+                                                       float persistence, uint64_t seed);
+
+    // Largest per-component difference between two volumes, for checking against the GPU bake
+    static float maxAbsDifference(const std::vector<glm::vec4> &a, const std::vector<glm::vec4> &b);
+
+    // Max deviation accepted between CPU and compute-shader volumes (float rounding and FMA only)
+    static constexpr float GPU_TOLERANCE = 1e-4f;
 };
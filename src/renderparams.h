@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "glm.hpp"
+#include "setting.h"
+
+// std140 mirror of the RenderParams block in Shaders/renderParams.glsl: the parts of Settings that every
+// scene program reads. Members are ordered so that no vec3 straddles a 16-byte boundary; keep both in sync.
+struct RenderParams {
+    struct Light {
+        int32_t type;
+        float pad0[3];
+        glm::vec4 pos;
+        glm::vec3 dir;
+        float pad1;
+        glm::vec3 color;
+        float longitude;
+        float latitude;
+        float pad2[3];
+    } testLight;
+
+    glm::vec3 volumeScaling;
+    int32_t numSteps;
+    glm::vec3 volumeTranslate;
+    float densityMult;
+
+    glm::vec4 hiResNoiseScaling;
+    glm::vec3 hiResNoiseTranslate;
+    float hiResDensityOffset;
+    glm::vec4 hiResChannelWeights;
+
+    glm::vec3 loResNoiseTranslate;
+    float loResNoiseScaling;
+    glm::vec4 loResChannelWeights;
+
+    glm::vec2 unormDensityRange;
+    float cloudLightAbsorptionMult;
+    float minLightTransmittance;
+    float loResDensityWeight;
+    uint32_t gammaCorrect;  // GLSL bools are 4 bytes in std140
+
+    static RenderParams fromSettings(const Settings &settings) {
+        RenderParams params = {};
+        params.testLight.type = settings.lightData.type;
+        params.testLight.pos = settings.lightData.pos;
+        params.testLight.dir = settings.lightData.dir;
+        params.testLight.color = settings.lightData.color;
+        params.testLight.longitude = settings.lightData.longitude;
+        params.testLight.latitude = settings.lightData.latitude;
+
+        params.volumeScaling = settings.volumeScaling;
+        params.numSteps = settings.numSteps;
+        params.volumeTranslate = settings.volumeTranslate;
+        params.densityMult = settings.densityMult;
+
+        params.hiResNoiseScaling = settings.hiResNoise.scaling;
+        params.hiResNoiseTranslate = settings.hiResNoise.translate;
+        params.hiResDensityOffset = settings.hiResNoise.densityOffset;
+        params.hiResChannelWeights = settings.hiResNoise.channelWeights;
+
+        params.loResNoiseTranslate = settings.loResNoise.translate;
+        params.loResNoiseScaling = settings.loResNoise.scaling[0];
+        params.loResChannelWeights = settings.loResNoise.channelWeights;
+
+        params.unormDensityRange = settings.unormDensityRange;
+        params.cloudLightAbsorptionMult = settings.cloudLightAbsorptionMult;
+        params.minLightTransmittance = settings.minLightTransmittance;
+        params.loResDensityWeight = settings.loResNoise.densityWeight;
+        params.gammaCorrect = settings.gammaCorrect;
+        return params;
+    }
+};
+
+static_assert(sizeof(RenderParams::Light) == 80, "std140 size of LightData");
+static_assert(offsetof(RenderParams, hiResNoiseScaling) == 112, "std140 offset of hiResNoiseScaling");
+static_assert(offsetof(RenderParams, unormDensityRange) == 192, "std140 offset of unormDensityRange");
+static_assert(sizeof(RenderParams) == 216, "std140 size of the RenderParams block");
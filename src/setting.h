@@ -1,6 +1,7 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+#include <cstdint>
 #include <string>
 #include <glm/glm.hpp>
 
@@ -21,6 +22,32 @@ struct NoiseParams {
     float densityWeight;                       // for hi-res detail noise
 };
 
+// Storage of the baked density volumes, see volumeFormatInfo in main.cpp
+enum VolumeFormat {
+    VOLUME_RGBA32F,       // 16 B/voxel, exact
+    VOLUME_RGBA16F,       //  8 B/voxel
+    VOLUME_RGBA8,         //  4 B/voxel, densities remapped from unormDensityRange
+    VOLUME_R8_CHANNELS,   //  4 B/voxel as four R8 textures, each sample fetches a single byte
+    VOLUME_FORMAT_COUNT
+};
+
+// Ray-march step settings compiled into default.frag, see cloudDefines in main.cpp
+enum CloudQuality {
+    CLOUD_QUALITY_LOW,
+    CLOUD_QUALITY_MEDIUM,
+    CLOUD_QUALITY_HIGH,  // the original fixed constants
+    CLOUD_QUALITY_COUNT
+};
+
+// How the terrain grid is sent to the GPU, see TerrainGenerator::generateTerrain
+enum TerrainMesh {
+    TERRAIN_MESH_ARRAYS,   // 6 vertices per quad, glDrawArrays(GL_TRIANGLES)
+    TERRAIN_MESH_INDEXED,  // each grid vertex once, 32-bit GL_TRIANGLES index buffer
+    TERRAIN_MESH_STRIP,    // each grid vertex once, one triangle strip per row separated by primitive restart
+    TERRAIN_MESH_CDLOD,    // quadtree of instanced patches picked per frame by screen-space error, see TerrainLOD
+    TERRAIN_MESH_TILES,    // unbounded terrain streamed in tiles around the camera, see TerrainTiles
+};
+
 struct LightParams {
     glm::vec3 color;
     glm::vec3 dir;
@@ -55,6 +82,8 @@ struct Settings {
     float cloudLightAbsorptionMult = 0.75f;
     float minLightTransmittance = 0.01f;
     bool invertDensity = true;
+    bool cubicErosion = false;  // (1 - d)^3 detail erosion instead of (1 - d)^6
+    int cloudQuality = CLOUD_QUALITY_HIGH;
 
     NoiseParams hiResNoise = {
         .resolution = 200,
@@ -92,6 +121,43 @@ struct Settings {
 
     int curSlot, curChannel; // to denote which one changed
 
+    uint64_t noiseSeed = 42;  // key of every random lattice (Worley points, Perlin gradients), see CounterRNG
+
+    bool useTiledWorley = true;        // worleyTiled.comb: 8x8x8 tiles, all RGBA channels per dispatch
+    bool hashWorleyPoints = true;      // Worley shaders derive cell points from noiseSeed, no point SSBOs; init only
+    bool bakeWorleyOnCPU = false;      // fill the volumes with Worley::createWorleyVolume3D instead of worley.comb
+    bool validateWorleyOnCPU = false;  // after a GPU bake, check it against the CPU engine
+    bool useVolumeCache = true;        // reuse baked volumes from volumeCacheDir across launches
+    std::string volumeCacheDir = "../cache/";
+    bool useShaderCache = true;        // load linked program binaries from shaderCacheDir instead of compiling
+    std::string shaderCacheDir = "../cache/shaders/";
+    bool hotReloadShaders = false;     // rebuild and swap in programs whose files in Shaders/ change while running
+    bool showProfiler = false;         // per-pass CPU/GPU timings overlay, see GpuProfiler; F3 toggles it
+    float frameBudgetMs = 1000.f / 60.f;  // frame target the profiler's histograms are scaled to
+    std::string profileExportPath = "../profile";  // + .csv / .json when exported from the overlay
+    int volumeFormat = VOLUME_RGBA32F;
+    glm::vec2 unormDensityRange = glm::vec2(0.f, 1.25f);  // Worley densities stay within ~[0, 1.15]
+    bool compareVolumeFormats = false;  // at startup, print error / memory / timing of every format
+    bool useLightVolume = false;     // one fetch from a baked transmittance volume instead of marching to the sun
+    int lightVolumeResolution = 64;  // voxels per axis of that volume, spread over the cloud box
+    bool useOccupancyGrid = false;   // ray marcher steps over macro cells of the box that cannot hold cloud
+    int occupancyGridResolution = 32;  // macro cells per axis of that grid
+    int densityMaxLod = 0;           // coarsest mip of the density volumes the ray marcher samples far away (0: level 0 only)
+    float farStepDistance = 0.f;     // past this distance from the camera, march steps grow in proportion to it (0: fixed steps)
+    int cloudCheckerSize = 1;        // march one pixel of every NxN block per frame and reproject the rest (1, 2 or 4)
+    int cloudDownsample = 1;         // run the cloud and sky shader at 1/N resolution and upsample onto the terrain (1, 2 or 4)
+    int terrainMesh = TERRAIN_MESH_ARRAYS;  // see TerrainMesh
+    int terrainPatchGrid = 32;         // TERRAIN_MESH_CDLOD: quads per patch side (even)
+    float terrainPixelError = 2.f;     // TERRAIN_MESH_CDLOD: largest projected vertex spacing, in pixels
+    int terrainOctaves = 1;            // fBm octaves of the height map
+    float terrainLacunarity = 2.f;     // frequency ratio between octaves, keep it an integer so the map tiles
+    float terrainGain = .5f;           // amplitude ratio between octaves
+    bool generateTerrainOnGPU = false; // terrainHeight.comb / terrainNormal.comb instead of TerrainGenerator's maps
+    bool validateTerrainOnCPU = false; // after a GPU generation, check it against TerrainGenerator
+    int terrainTileRadius = 2;         // TERRAIN_MESH_TILES: tiles kept around the camera tile in each direction
+    int terrainTileCache = 40;         // TERRAIN_MESH_TILES: resident tiles, the least recently used are recycled
+    int terrainTileUploadsPerFrame = 2;  // TERRAIN_MESH_TILES: finished tiles copied to the GPU per frame
+
     // Camera
     double nearPlane = 0.01;
     double farPlane = 100.0;
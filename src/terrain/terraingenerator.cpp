@@ -1,9 +1,14 @@
 #include "terraingenerator.h"
+#include "../utils/threadpool.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <ostream>
 #include "glm.hpp"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 
 
@@ -20,18 +25,14 @@ TerrainGenerator::TerrainGenerator()
 // Destructor
 TerrainGenerator::~TerrainGenerator(){}
 
-// Helper for generateTerrain()
-void addPointToVector(glm::vec3 point, std::vector<float>& vector) {
-    vector.push_back(point.x);
-    vector.push_back(point.z);
-    vector.push_back(point.y);
-}
-
-
 // scaling version zhou
 void TerrainGenerator::generateTerrain() {
-    auto perlinGen = Perlin(m_cellSize, m_noiseMapSize);
-    auto noiseMap = perlinGen.formNoiseMap();
+    Perlin perlinGen(m_cellSize, m_noiseMapSize, m_seed);
+    generateTerrain(perlinGen);
+}
+
+void TerrainGenerator::generateTerrain(Perlin &perlinGen) {
+    auto noiseMap = perlinGen.formNoiseMap(m_octaves, m_lacunarity, m_gain);
 
 //    for (auto &v : noiseMap)
 //        v = v / 3;
@@ -39,19 +40,119 @@ void TerrainGenerator::generateTerrain() {
     // get height map
     height_data = noiseMap;
 
-    // get xz map
-    xz_data.reserve(m_xScale * m_noiseMapSize * m_yScale * m_noiseMapSize * 6);
-    for(int x = 0; x < m_xScale * m_noiseMapSize; x++) {
-        for(int z = 0; z < m_yScale * m_noiseMapSize; z++) {
+    generateMesh();
+
+    generateNormals();
+}
+
+/* Normal and color maps, one texel per height sample, in a single pass over the height map.
+ * The normal of a vertex is the sum of cross products over its ring of 8 neighbours; those reduce to
+ * (Sx, Sy, 8 / N) with Sx, Sy the Sobel derivatives of the heights along rows and columns,
+ * so each row only needs the (wrapped) rows above and below it.
+ */
+void TerrainGenerator::generateNormals() {
+    const int N = m_noiseMapSize;
+    const int rows = std::min(int(m_xScale * N), N);
+    const int cols = std::min(int(m_yScale * N), N);
+    const float up = 8.f / N;
+    normal_data.resize(size_t(rows) * cols * 3);
+    color_data.resize(size_t(rows) * cols * 3);
+
+    ThreadPool::global().parallelFor(0, rows, [&](int x) {
+        const float *above = &height_data[size_t((x - 1 + N) % N) * N];
+        const float *row = &height_data[size_t(x) * N];
+        const float *below = &height_data[size_t((x + 1) % N) * N];
+        float *normals = &normal_data[size_t(x) * cols * 3];
+        float *colors = &color_data[size_t(x) * cols * 3];
+
+        // [1 2 1] smoothed differences across rows (sx) and columns (sy)
+        auto sobel = [&](int z, float &sx, float &sy) {
+            const int zm = (z - 1 + N) % N, zp = (z + 1) % N;
+            sx = (above[zm] + 2 * above[z] + above[zp]) - (below[zm] + 2 * below[z] + below[zp]);
+            sy = (above[zm] + 2 * row[zm] + below[zm]) - (above[zp] + 2 * row[zp] + below[zp]);
+        };
+        // stored as (x, height, z), the layout the terrain shaders sample
+        auto store = [&](int z, float sx, float sy) {
+            const float invLength = 1.f / std::sqrt(sx * sx + sy * sy + up * up);
+            normals[3 * z + 0] = sx * invLength;
+            normals[3 * z + 1] = up * invLength;
+            normals[3 * z + 2] = sy * invLength;
+        };
+
+        int z = 0;
+        float sx, sy;
+        if (cols > 0) {  // left neighbour wraps around
+            sobel(0, sx, sy);
+            store(0, sx, sy);
+            z = 1;
+        }
+#if defined(__AVX2__)
+        const __m256 two = _mm256_set1_ps(2.f);
+        const __m256 up2 = _mm256_set1_ps(up * up);
+        alignas(32) float nx[8], ny[8], nz[8];
+        for (; z + 8 < std::min(cols, N); z += 8) {  // z + 8 <= N - 1, so z + 1 never wraps
+            const __m256 aL = _mm256_loadu_ps(above + z - 1), aC = _mm256_loadu_ps(above + z), aR = _mm256_loadu_ps(above + z + 1);
+            const __m256 rL = _mm256_loadu_ps(row + z - 1), rR = _mm256_loadu_ps(row + z + 1);
+            const __m256 bL = _mm256_loadu_ps(below + z - 1), bC = _mm256_loadu_ps(below + z), bR = _mm256_loadu_ps(below + z + 1);
+            const __m256 vsx = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(aL, _mm256_mul_ps(two, aC)), aR),
+                                             _mm256_add_ps(_mm256_add_ps(bL, _mm256_mul_ps(two, bC)), bR));
+            const __m256 vsy = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(aL, _mm256_mul_ps(two, rL)), bL),
+                                             _mm256_add_ps(_mm256_add_ps(aR, _mm256_mul_ps(two, rR)), bR));
+            const __m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vsx, vsx), _mm256_mul_ps(vsy, vsy)), up2);
+            const __m256 invLength = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(length2));
+            _mm256_store_ps(nx, _mm256_mul_ps(vsx, invLength));
+            _mm256_store_ps(ny, _mm256_mul_ps(_mm256_set1_ps(up), invLength));
+            _mm256_store_ps(nz, _mm256_mul_ps(vsy, invLength));
+            for (int lane = 0; lane < 8; lane++) {
+                normals[3 * (z + lane) + 0] = nx[lane];
+                normals[3 * (z + lane) + 1] = ny[lane];
+                normals[3 * (z + lane) + 2] = nz[lane];
+            }
+        }
+#endif
+        for (; z < cols; z++) {
+            sobel(z, sx, sy);
+            store(z, sx, sy);
+        }
+
+        for (z = 0; z < cols; z++) {
+            const glm::vec3 normal(normals[3 * z], normals[3 * z + 2], normals[3 * z + 1]);
+            const glm::vec3 color = getColor(normal, glm::vec3(1.f * x / N, 1.f * z / N, row[z]));
+            colors[3 * z + 0] = color.x;
+            colors[3 * z + 1] = color.z;
+            colors[3 * z + 2] = color.y;
+        }
+    });
+}
+
+// get xz map: numX x numZ quads, the height map repeats every m_noiseMapSize quads
+void TerrainGenerator::generateMesh() {
+    const int numX = m_xScale * m_noiseMapSize;
+    const int numZ = m_yScale * m_noiseMapSize;
+    xz_data.clear();
+    index_data.clear();
+    if (m_meshMode == TERRAIN_MESH_ARRAYS)
+        generateQuadVertices(numX, numZ);
+    else if (m_meshMode != TERRAIN_MESH_CDLOD && m_meshMode != TERRAIN_MESH_TILES)  // TerrainLOD / TerrainTiles draw their own patches
+        generateGridVertices(numX, numZ);
+}
+
+// Two triangles (6 vertices) per quad, for glDrawArrays
+void TerrainGenerator::generateQuadVertices(int numX, int numZ) {
+    xz_data.reserve(size_t(numX) * numZ * 6 * 2);
+    for(int x = 0; x < numX; x++) {
+        for(int z = 0; z < numZ; z++) {
             int x1 = x;
             int z1 = z;
             int x2 = x + 1;
             int z2 = z + 1;
 
-            glm::vec3 p1 = getPosition(x1, z1);
-            glm::vec3 p2 = getPosition(x2, z1);
-            glm::vec3 p3 = getPosition(x2, z2);
-            glm::vec3 p4 = getPosition(x1, z2);
+            // grid positions only, the heights come from the height map in the shader
+            auto coord = [this](int i) { return float(1.0 * i / m_noiseMapSize); };
+            glm::vec2 p1(coord(x1), coord(z1));
+            glm::vec2 p2(coord(x2), coord(z1));
+            glm::vec2 p3(coord(x2), coord(z2));
+            glm::vec2 p4(coord(x1), coord(z2));
 
             // push p3: [x2, z2]
             xz_data.push_back(p3.x);
@@ -72,24 +173,42 @@ void TerrainGenerator::generateTerrain() {
             // push p1: [x1, z1]
             xz_data.push_back(p1.x);
             xz_data.push_back(p1.y);
-
-            if (x<m_noiseMapSize && z<m_noiseMapSize) {
-                glm::vec3 n1 = getNormal(x1, z1);
-                glm::vec3 c1 = getColor(n1, p1);
-                addPointToVector(n1, normal_data);
-                addPointToVector(c1, color_data);
-            }
-
         }
     }
 }
 
-
-glm::vec3 TerrainGenerator::getPosition(int row, int col) {
-    float x = 1.0 * row / m_noiseMapSize ;
-    float y = 1.0 * col / m_noiseMapSize ;
-    float z = getHeight(row, col);
-    return glm::vec3(x,y,z);
+// Every grid vertex once, plus an index buffer with the same triangles (and winding) as generateQuadVertices
+void TerrainGenerator::generateGridVertices(int numX, int numZ) {
+    xz_data.reserve(size_t(numX + 1) * (numZ + 1) * 2);
+    for (int x = 0; x <= numX; x++) {
+        for (int z = 0; z <= numZ; z++) {
+            xz_data.push_back(1.0 * x / m_noiseMapSize);
+            xz_data.push_back(1.0 * z / m_noiseMapSize);
+        }
+    }
+    auto vertex = [numZ](int x, int z) { return uint32_t(x * (numZ + 1) + z); };
+
+    if (m_meshMode == TERRAIN_MESH_INDEXED) {
+        index_data.reserve(size_t(numX) * numZ * 6);
+        for (int x = 0; x < numX; x++) {
+            for (int z = 0; z < numZ; z++) {
+                // p1: [x, z], p2: [x+1, z], p3: [x+1, z+1], p4: [x, z+1]
+                index_data.insert(index_data.end(), {vertex(x + 1, z + 1), vertex(x + 1, z), vertex(x, z),
+                                                     vertex(x, z + 1), vertex(x + 1, z + 1), vertex(x, z)});
+            }
+        }
+    } else {
+        // One strip per row of quads: [x+1, z], [x, z], [x+1, z+1], [x, z+1], ...
+        // gives the triangles (p2, p1, p3) and (p3, p1, p4), i.e. the same diagonal p1-p3 as above
+        index_data.reserve(size_t(numX) * (2 * (numZ + 1) + 1));
+        for (int x = 0; x < numX; x++) {
+            if (x > 0) index_data.push_back(PRIMITIVE_RESTART_INDEX);
+            for (int z = 0; z <= numZ; z++) {
+                index_data.push_back(vertex(x + 1, z));
+                index_data.push_back(vertex(x, z));
+            }
+        }
+    }
 }
 
 
@@ -103,39 +222,6 @@ void TerrainGenerator::setTranslation(glm::vec3 trans) {
 }
 
 
-float TerrainGenerator::getHeight(int row, int col) {
-    int modRow = (row+m_noiseMapSize)%m_noiseMapSize;
-    int modCol = (col+m_noiseMapSize)%m_noiseMapSize;
-    int index = modRow*m_noiseMapSize + modCol;
-    return height_data[index];
-}
-
-// Computes the normal of a vertex by averaging neighbors
-glm::vec3 TerrainGenerator::getNormal(int row, int col) {
-    glm::vec3 normal = glm::vec3(0, 0, 0);
-    std::vector<std::vector<int>> neighborOffsets = { // Counter-clockwise around the vertex
-     {-1, -1},
-     { 0, -1},
-     { 1, -1},
-     { 1,  0},
-     { 1,  1},
-     { 0,  1},
-     {-1,  1},
-     {-1,  0}
-    };
-    glm::vec3 V = getPosition(row,col);
-    for (int i = 0; i < 8; ++i) {
-     int n1RowOffset = neighborOffsets[i][0];
-     int n1ColOffset = neighborOffsets[i][1];
-     int n2RowOffset = neighborOffsets[(i + 1) % 8][0];
-     int n2ColOffset = neighborOffsets[(i + 1) % 8][1];
-     glm::vec3 n1 = getPosition(row + n1RowOffset, col + n1ColOffset);
-     glm::vec3 n2 = getPosition(row + n2RowOffset, col + n2ColOffset);
-     normal = normal + glm::cross(n1 - V, n2 - V);
-    }
-    return glm::normalize(normal);
-}
-
 // TODO: change to the other computing methods by using the height and normal
 glm::vec3 TerrainGenerator::getColor(glm::vec3 normal, glm::vec3 position) {
 
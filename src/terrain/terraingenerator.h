@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstdint>
+#include <utility>
 #include <vector>
 #include "glm.hpp"
 #include "../noise/perlin-zhou.h"
+#include "../setting.h"
 
 class TerrainGenerator
 {
@@ -13,35 +16,58 @@ public:
 
 // get functions
     int getResolution() { return m_noiseMapSize; };
+    int getCellSize() { return m_cellSize; };
     float getScaleX() { return m_xScale; };
     float getScaleY() { return m_yScale; };
-    std::vector<float> getHeightMap() { return height_data; };
-    std::vector<float> getNormalMap() { return normal_data; };
-    std::vector<float> getColorMap() { return color_data; };
-    std::vector<float> getCoordMap() { return xz_data; };
+    const std::vector<float> &getHeightMap() const { return height_data; };
+    const std::vector<float> &getNormalMap() const { return normal_data; };
+    const std::vector<float> &getColorMap() const { return color_data; };
+    const std::vector<float> &getCoordMap() const { return xz_data; };
+    const std::vector<uint32_t> &getIndices() const { return index_data; };  // empty for TERRAIN_MESH_ARRAYS
+
+// move the buffers out once they are uploaded, the generator is left with empty ones
+    std::vector<float> takeHeightMap() { return std::move(height_data); };
+    std::vector<float> takeNormalMap() { return std::move(normal_data); };
+    std::vector<float> takeColorMap() { return std::move(color_data); };
+    std::vector<float> takeCoordMap() { return std::move(xz_data); };
+    std::vector<uint32_t> takeIndices() { return std::move(index_data); };
+    TerrainMesh getMeshMode() const { return m_meshMode; };
+
+    static constexpr uint32_t PRIMITIVE_RESTART_INDEX = 0xffffffffu;  // GL_PRIMITIVE_RESTART_FIXED_INDEX for 32-bit
 
 // update functions
     void setResolution(int res) {  m_noiseMapSize = res; };
     void setMxMy(float x, float y);
     void setTranslation(glm::vec3 trans);
+    void setMeshMode(TerrainMesh mode) { m_meshMode = mode; };
+    void setOctaves(int octaves, float lacunarity, float gain) { m_octaves = octaves; m_lacunarity = lacunarity; m_gain = gain; };
+    void setSeed(uint64_t seed) { m_seed = seed; };  // of the Perlin lattice generateTerrain() makes
 
 // generator functions
     void generateTerrain();
+    void generateTerrain(Perlin &noise);  // height, normal and color maps from this lattice, plus the mesh
+    void generateMesh();                  // only the xz grid (and indices) for the mesh mode
 
 private:
 
     int m_cellSize, m_noiseMapSize; // perlin noise related
+    int m_octaves = 1;
+    uint64_t m_seed = 0;
+    float m_lacunarity = 2.f, m_gain = .5f;
     float m_xScale;
     float m_yScale;
+    TerrainMesh m_meshMode = TERRAIN_MESH_ARRAYS;
     glm::vec3 translation;
     std::vector<float> height_data;
     std::vector<float> normal_data;
     std::vector<float> color_data;
     std::vector<float> xz_data;
+    std::vector<uint32_t> index_data;
 
-    glm::vec3 getPosition(int row, int col);
-    float getHeight(int row, int col);
-    glm::vec3 getNormal(int row, int col);
     glm::vec3 getColor(glm::vec3 normal, glm::vec3 position);
 
+    void generateNormals();
+    void generateQuadVertices(int numX, int numZ);
+    void generateGridVertices(int numX, int numZ);
+
 };
@@ -0,0 +1,122 @@
+#include "terrainlod.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+void TerrainLOD::build(const std::vector<float> &heightMap, int resolution, float heightScale,
+                       glm::vec2 extent, int patchGrid) {
+    this->extent = extent;
+    this->patchGrid = patchGrid;
+
+    // Leaves at about the spacing of the height map, sized so that they tile its period
+    leafSize = 1.f;
+    while (leafSize > float(patchGrid) / resolution)
+        leafSize /= 2;
+
+    levels = 1;
+    while (leafSize * float(1 << (levels - 1)) < std::max(extent.x, extent.y) && levels < MAX_LEVELS)
+        levels++;
+
+    // Height bounds of the leaves in one period, one extra sample around each for the bilinear filter
+    heightBounds.clear();
+    int nodesPerPeriod = int(std::lround(1.f / leafSize));
+    std::vector<glm::vec2> bounds(nodesPerPeriod * nodesPerPeriod);
+    for (int x = 0; x < nodesPerPeriod; x++) {
+        for (int z = 0; z < nodesPerPeriod; z++) {
+            glm::vec2 &b = bounds[x * nodesPerPeriod + z];
+            b = glm::vec2(1e30f, -1e30f);
+            for (int row = int(std::floor(x * leafSize * resolution)) - 1; row <= int(std::ceil((x + 1) * leafSize * resolution)) + 1; row++) {
+                for (int col = int(std::floor(z * leafSize * resolution)) - 1; col <= int(std::ceil((z + 1) * leafSize * resolution)) + 1; col++) {
+                    float h = heightScale * heightMap[((row + resolution) % resolution) * resolution + (col + resolution) % resolution];
+                    b = glm::vec2(std::min(b.x, h), std::max(b.y, h));
+                }
+            }
+        }
+    }
+    heightBounds.push_back(bounds);
+
+    // Coarser levels up to a single node per period, larger nodes use the bounds of the whole map
+    while (nodesPerPeriod > 1) {
+        const std::vector<glm::vec2> &fine = heightBounds.back();
+        const int n = nodesPerPeriod / 2;
+        std::vector<glm::vec2> coarse(n * n);
+        for (int x = 0; x < n; x++) {
+            for (int z = 0; z < n; z++) {
+                glm::vec2 &b = coarse[x * n + z];
+                b = glm::vec2(1e30f, -1e30f);
+                for (int c = 0; c < 4; c++) {
+                    const glm::vec2 &child = fine[(2 * x + c / 2) * nodesPerPeriod + 2 * z + c % 2];
+                    b = glm::vec2(std::min(b.x, child.x), std::max(b.y, child.y));
+                }
+            }
+        }
+        heightBounds.push_back(coarse);
+        nodesPerPeriod = n;
+    }
+}
+
+void TerrainLOD::buildPatchMesh(int patchGrid, std::vector<float> &vertices, std::vector<uint32_t> &indices) {
+    vertices.clear();
+    indices.clear();
+    for (int x = 0; x <= patchGrid; x++) {
+        for (int z = 0; z <= patchGrid; z++) {
+            vertices.push_back(float(x) / patchGrid);
+            vertices.push_back(float(z) / patchGrid);
+        }
+    }
+    auto vertex = [patchGrid](int x, int z) { return uint32_t(x * (patchGrid + 1) + z); };
+    for (int x = 0; x < patchGrid; x++) {
+        for (int z = 0; z < patchGrid; z++) {
+            indices.insert(indices.end(), {vertex(x + 1, z + 1), vertex(x + 1, z), vertex(x, z),
+                                           vertex(x, z + 1), vertex(x + 1, z + 1), vertex(x, z)});
+        }
+    }
+}
+
+void TerrainLOD::select(const glm::vec3 &cameraPos, const glm::mat4 &projView, float pixelsPerRadian, float pixelError) {
+    this->cameraPos = cameraPos;
+
+    frustum = Frustum(projView);
+
+    // A vertex spacing s projects to s * pixelsPerRadian / d pixels, so a level is fine enough from
+    // d = s * lodDistance on. Ranges of a few patch sizes at least keep the morph regions apart.
+    lodDistance = std::max(pixelsPerRadian / pixelError, 4.f * patchGrid);
+
+    // Vertices of level L reach the coarser grid where level L + 1 takes over
+    morphRanges.resize(levels);
+    for (int level = 0; level < levels; level++) {
+        const float end = 2.f * lodDistance * leafSize * float(1 << level) / patchGrid;
+        morphRanges[level] = level + 1 < levels ? glm::vec2(.75f * end, end) : glm::vec2(1e30f, 2e30f);
+    }
+
+    patches.clear();
+    selectNode(levels - 1, 0, 0);
+}
+
+void TerrainLOD::selectNode(int level, int x, int z) {
+    const float size = leafSize * float(1 << level);
+    const glm::vec2 origin = glm::vec2(x, z) * size;
+    if (origin.x >= extent.x || origin.y >= extent.y)
+        return;
+
+    glm::vec2 bounds;
+    if (level < int(heightBounds.size())) {
+        const int n = 1 << (int(heightBounds.size()) - 1 - level);  // nodes per period
+        bounds = heightBounds[level][(x % n) * n + z % n];
+    } else {
+        bounds = heightBounds.back()[0];
+    }
+    const glm::vec3 boxMin(origin.x, bounds.x, origin.y);
+    const glm::vec3 boxMax(std::min(origin.x + size, extent.x), bounds.y, std::min(origin.y + size, extent.y));
+    if (!frustum.intersects(boxMin, boxMax))
+        return;
+
+    const float distance = glm::length(cameraPos - glm::clamp(cameraPos, boxMin, boxMax));
+    if (level == 0 || distance >= lodDistance * size / patchGrid) {
+        patches.emplace_back(origin, size, level);
+        return;
+    }
+    for (int c = 0; c < 4; c++)
+        selectNode(level - 1, 2 * x + c / 2, 2 * z + c % 2);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "glm.hpp"
+#include "../utils/frustum.h"
+
+// CDLOD quadtree over the terrain (TERRAIN_MESH_CDLOD).
+// Every node is drawn with the same patchGrid x patchGrid instanced patch, so a node at level L
+// (0: leaves) has a vertex spacing of leafSize * 2^L / patchGrid. Nodes are split while their
+// projected vertex spacing exceeds the pixel error, which for a fixed camera is a distance range
+// per level; vertices morph onto the next coarser grid before that range ends (see terrainGen.vert),
+// so neighbouring levels meet without cracks.
+// Terrain space is the one of TerrainGenerator: (x, height, z) with x, z in [0, extent].
+class TerrainLOD
+{
+public:
+    static constexpr int MAX_LEVELS = 16;  // MAX_LOD_LEVELS in terrainGen.vert
+
+    // heightMap: resolution x resolution samples repeating every terrain unit, scaled by heightScale
+    void build(const std::vector<float> &heightMap, int resolution, float heightScale,
+               glm::vec2 extent, int patchGrid);
+
+    // Picks the patches for this frame. projView maps terrain space to clip space,
+    // pixelsPerRadian = screen height / (2 * tan(fov / 2)).
+    void select(const glm::vec3 &cameraPos, const glm::mat4 &projView, float pixelsPerRadian, float pixelError);
+
+    const std::vector<glm::vec4> &getPatches() const { return patches; };  // xy: origin, z: size, w: level
+    const std::vector<glm::vec2> &getMorphRanges() const { return morphRanges; };  // per level, distances
+    int getLevels() const { return levels; };
+    int getPatchGrid() const { return patchGrid; };
+    glm::vec2 getExtent() const { return extent; };
+
+    // Unit patch with (patchGrid + 1)^2 vertices in [0, 1]^2, same triangulation as TerrainGenerator
+    static void buildPatchMesh(int patchGrid, std::vector<float> &vertices, std::vector<uint32_t> &indices);
+
+private:
+    int levels = 0;
+    int patchGrid = 32;
+    float leafSize = 1.f;
+    glm::vec2 extent;
+    std::vector<std::vector<glm::vec2>> heightBounds;  // per level, (min, max) of each node, row-major
+    std::vector<glm::vec2> morphRanges;
+    std::vector<glm::vec4> patches;
+
+    Frustum frustum;
+    glm::vec3 cameraPos;
+    float lodDistance;  // distance per unit of vertex spacing at which a level is coarse enough
+
+    void selectNode(int level, int x, int z);
+};
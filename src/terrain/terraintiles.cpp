@@ -0,0 +1,270 @@
+#include "terraintiles.h"
+#include "../utils/frustum.h"
+#include "../utils/threadpool.h"
+#include "gtc/constants.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Integer hash of a lattice point, the same point always gets the same gradient
+uint32_t hashLattice(int64_t x, int64_t y, uint32_t seed) {
+    uint32_t h = seed * 0x9e3779b9u ^ uint32_t(x) * 0x85ebca6bu ^ uint32_t(x >> 32) * 0x27d4eb2fu;
+    h ^= uint32_t(y) * 0xc2b2ae35u ^ uint32_t(y >> 32) * 0x165667b1u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+float curve(float t) {
+    return t * t * (3 - 2 * t);
+}
+
+float lerp(float a, float b, float t) {
+    return a + t * (b - a);
+}
+
+// Perlin noise over the unbounded lattice, x along rows and y along columns like Perlin::sample2D
+float hashedPerlin(double x, double y, uint32_t seed) {
+    const double cellX = std::floor(x), cellY = std::floor(y);
+    const float fracX = float(x - cellX), fracY = float(y - cellY);
+    auto dot = [&](int dx, int dy) {
+        const float theta = float(hashLattice(int64_t(cellX) + dx, int64_t(cellY) + dy, seed)) * (glm::two_pi<float>() / 4294967296.f);
+        return std::sin(theta) * (fracX - dx) + std::cos(theta) * (fracY - dy);
+    };
+    const float vx0 = lerp(dot(0, 0), dot(1, 0), curve(fracX));
+    const float vx1 = lerp(dot(0, 1), dot(1, 1), curve(fracX));
+    return lerp(vx0, vx1, curve(fracY));
+}
+
+}
+
+TerrainTiles::TerrainTiles(const Params &params) :
+    m_params(params), m_pending(std::make_shared<Pending>()) {
+    const int samples = m_params.resolution + 1;
+    m_params.capacity = std::max(m_params.capacity, (2 * m_params.radius + 1) * (2 * m_params.radius + 1));
+    m_tileBytes = size_t(samples) * samples * sizeof(glm::vec4);
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA32F, samples, samples, m_params.capacity);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // One slot per upload in flight, written by the CPU while the GPU copies out of the others
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &m_pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, PBO_SLOTS * m_tileBytes, nullptr, flags);
+    m_pboMemory = static_cast<char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, PBO_SLOTS * m_tileBytes, flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    for (int layer = m_params.capacity - 1; layer >= 0; layer--)
+        m_freeLayers.push_back(layer);
+}
+
+TerrainTiles::~TerrainTiles() {
+    {
+        std::lock_guard<std::mutex> lock(m_pending->mutex);
+        m_pending->cancelled = true;
+        m_pending->ready.clear();
+    }
+    for (GLsync &fence : m_pboFences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &m_pbo);
+    glDeleteTextures(1, &m_texture);
+}
+
+/* Heights come from fBm on an apron one sample wider than the tile, so the Sobel normals
+ * at the tile border see the neighbouring tile's heights and the seams stay invisible.
+ * Octave i uses its own seed instead of Perlin's lattice offset, the lattice is not periodic here.
+ */
+std::vector<glm::vec4> TerrainTiles::generateTile(const Params &params, glm::ivec2 tile, glm::vec2 &heightBounds) {
+    const int R = params.resolution;
+    const int apron = R + 3;
+    std::vector<float> heights(size_t(apron) * apron, 0.f);
+    for (int a = 0; a < apron; a++) {
+        for (int b = 0; b < apron; b++) {
+            const double x = double(int64_t(tile.x) * R + a - 1) / params.cellSize;
+            const double y = double(int64_t(tile.y) * R + b - 1) / params.cellSize;
+            double frequency = 1.;
+            float amplitude = 1.f, height = 0.f;
+            for (int octave = 0; octave < params.octaves; octave++) {
+                height += amplitude * hashedPerlin(x * frequency, y * frequency, params.seed + uint32_t(octave));
+                frequency *= params.lacunarity;
+                amplitude *= params.gain;
+            }
+            heights[size_t(a) * apron + b] = height;
+        }
+    }
+
+    // Same normals as TerrainGenerator::generateNormals, with the apron instead of wrapping
+    const float up = 8.f / R;
+    std::vector<glm::vec4> texels(size_t(R + 1) * (R + 1));
+    heightBounds = glm::vec2(1e30f, -1e30f);
+    for (int a = 0; a < R + 1; a++) {
+        const float *above = &heights[size_t(a) * apron + 1];
+        const float *row = &heights[size_t(a + 1) * apron + 1];
+        const float *below = &heights[size_t(a + 2) * apron + 1];
+        for (int b = 0; b < R + 1; b++) {
+            const float sx = (above[b - 1] + 2 * above[b] + above[b + 1]) - (below[b - 1] + 2 * below[b] + below[b + 1]);
+            const float sy = (above[b - 1] + 2 * row[b - 1] + below[b - 1]) - (above[b + 1] + 2 * row[b + 1] + below[b + 1]);
+            texels[size_t(a) * (R + 1) + b] = glm::vec4(glm::normalize(glm::vec3(sx, up, sy)), row[b]);
+            heightBounds = glm::vec2(std::min(heightBounds.x, row[b]), std::max(heightBounds.y, row[b]));
+        }
+    }
+    return texels;
+}
+
+void TerrainTiles::request(Key key) {
+    m_requested.insert(key);
+    ThreadPool::global().submit([params = m_params, pending = m_pending, key] {
+        if (pending->cancelled)
+            return;
+        ReadyTile tile{key, {}, {}};
+        tile.texels = generateTile(params, glm::ivec2(key.first, key.second), tile.heightBounds);
+        std::lock_guard<std::mutex> lock(pending->mutex);
+        if (!pending->cancelled)
+            pending->ready.push_back(std::move(tile));
+    });
+}
+
+// Least recently used layer among the tiles that are no longer wanted, -1 if every layer is wanted
+int TerrainTiles::allocateLayer(const std::set<Key> &wanted) {
+    if (!m_freeLayers.empty()) {
+        const int layer = m_freeLayers.back();
+        m_freeLayers.pop_back();
+        return layer;
+    }
+    for (auto it = m_lru.rbegin(); it != m_lru.rend(); ++it) {
+        if (wanted.count(*it))
+            continue;
+        const Key victim = *it;
+        const int layer = m_resident[victim].layer;
+        m_lru.erase(std::next(it).base());
+        m_resident.erase(victim);
+        return layer;
+    }
+    return -1;
+}
+
+// Copies the tile into the next PBO slot and from there into its layer, false if the slot is still busy or
+// no layer can be freed
+bool TerrainTiles::upload(ReadyTile &tile, const std::set<Key> &wanted) {
+    const int slot = m_nextPboSlot;
+    GLsync &fence = m_pboFences[slot];
+    if (fence) {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return false;
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    const int layer = allocateLayer(wanted);
+    if (layer < 0)
+        return false;
+    m_nextPboSlot = (m_nextPboSlot + 1) % PBO_SLOTS;
+
+    const size_t offset = size_t(slot) * m_tileBytes;
+    std::memcpy(m_pboMemory + offset, tile.texels.data(), m_tileBytes);
+    // texels are z fastest, so s = z and t = x as in the terrain height map
+    const int samples = m_params.resolution + 1;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, samples, samples, 1,
+                    GL_RGBA, GL_FLOAT, reinterpret_cast<const void *>(offset));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    m_lru.push_front(tile.key);
+    m_resident[tile.key] = Resident{layer, tile.heightBounds, m_lru.begin()};
+    return true;
+}
+
+void TerrainTiles::update(const glm::vec3 &cameraPos, const glm::mat4 &projView) {
+    const glm::ivec2 center(int(std::floor(cameraPos.x)), int(std::floor(cameraPos.z)));
+    const int r = m_params.radius;
+
+    // Wanted tiles, nearest first so they are generated and uploaded first
+    std::vector<Key> ring;
+    for (int i = -r; i <= r; i++) {
+        for (int j = -r; j <= r; j++)
+            ring.emplace_back(center.x + i, center.y + j);
+    }
+    std::stable_sort(ring.begin(), ring.end(), [&](const Key &a, const Key &b) {
+        return std::max(std::abs(a.first - center.x), std::abs(a.second - center.y))
+             < std::max(std::abs(b.first - center.x), std::abs(b.second - center.y));
+    });
+    const std::set<Key> wanted(ring.begin(), ring.end());
+
+    for (auto it = ring.rbegin(); it != ring.rend(); ++it) {
+        auto resident = m_resident.find(*it);
+        if (resident != m_resident.end())
+            m_lru.splice(m_lru.begin(), m_lru, resident->second.lruPosition);
+    }
+    for (const Key &key : ring) {
+        if (!m_resident.count(key) && !m_requested.count(key))
+            request(key);
+    }
+
+    // Finished tiles, the ones the camera has left are dropped (and regenerated if it comes back)
+    std::vector<ReadyTile> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_pending->mutex);
+        ready.swap(m_pending->ready);
+    }
+    std::vector<ReadyTile> kept;
+    for (ReadyTile &tile : ready) {
+        if (wanted.count(tile.key)) {
+            kept.push_back(std::move(tile));
+        } else {
+            m_requested.erase(tile.key);
+        }
+    }
+    std::sort(kept.begin(), kept.end(), [&](const ReadyTile &a, const ReadyTile &b) {
+        return std::max(std::abs(a.key.first - center.x), std::abs(a.key.second - center.y))
+             < std::max(std::abs(b.key.first - center.x), std::abs(b.key.second - center.y));
+    });
+    int uploads = 0;
+    std::vector<ReadyTile> waiting;
+    for (ReadyTile &tile : kept) {
+        if (uploads < m_params.uploadsPerFrame && upload(tile, wanted)) {
+            m_requested.erase(tile.key);
+            uploads++;
+        } else {
+            waiting.push_back(std::move(tile));
+        }
+    }
+    if (!waiting.empty()) {
+        std::lock_guard<std::mutex> lock(m_pending->mutex);
+        for (ReadyTile &tile : waiting)
+            m_pending->ready.push_back(std::move(tile));
+    }
+
+    // Resident wanted tiles inside the frustum, heights as TerrainGenerator scales them
+    const Frustum frustum(projView);
+    m_visible.clear();
+    for (const Key &key : ring) {
+        auto resident = m_resident.find(key);
+        if (resident == m_resident.end())
+            continue;
+        const glm::vec2 bounds = resident->second.heightBounds / 3.f;
+        const glm::vec3 boxMin(key.first, bounds.x, key.second);
+        const glm::vec3 boxMax(key.first + 1, bounds.y, key.second + 1);
+        if (frustum.intersects(boxMin, boxMax))
+            m_visible.emplace_back(key.first, key.second, resident->second.layer, 0.f);
+    }
+}
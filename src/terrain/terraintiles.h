@@ -0,0 +1,94 @@
+#pragma once
+
+#ifdef __APPLE__
+#define GL_SILENCE_DEPRECATION
+#endif
+#include <GL/glew.h>
+#include <cstdint>
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "glm.hpp"
+
+/* Streaming terrain for TERRAIN_MESH_TILES: unit tiles of non-repeating noise in a ring around the camera.
+ * Tiles are generated on ThreadPool workers from world-space Perlin fBm (hashed lattice gradients, so
+ * neighbouring tiles share their border samples exactly) and uploaded a few per frame through a ring of
+ * persistently mapped PBOs into layers of one RGBA32F texture array (xyz: normal, w: height).
+ * Layers are recycled least recently used first, so tiles the camera just left stay resident.
+ * Terrain space is the one of TerrainGenerator: tile (i, j) covers x in [i, i + 1), z in [j, j + 1).
+ */
+class TerrainTiles
+{
+public:
+    struct Params {
+        int resolution = 200;     // quads per tile side, the texture holds (resolution + 1)^2 samples
+        int cellSize = 25;        // samples per lattice cell of the first octave
+        int octaves = 1;
+        float lacunarity = 2.f;
+        float gain = .5f;
+        uint32_t seed = 0;
+        int radius = 2;           // tiles kept around the camera tile in each direction
+        int capacity = 40;        // texture array layers, at least (2 * radius + 1)^2
+        int uploadsPerFrame = 2;  // tiles copied into the texture array per update()
+    };
+
+    static constexpr int PBO_SLOTS = 4;  // tile uploads that can be in flight on the GPU
+
+    TerrainTiles(const Params &params);
+    ~TerrainTiles();  // waits for nothing: workers still running drop their results
+
+    // Call once per frame with the camera in terrain space: requests missing tiles, uploads finished ones,
+    // and picks the resident tiles inside the frustum of projView (terrain space to clip space)
+    void update(const glm::vec3 &cameraPos, const glm::mat4 &projView);
+
+    GLuint getTexture() const { return m_texture; };
+    int getResolution() const { return m_params.resolution; };
+    const std::vector<glm::vec4> &getVisibleTiles() const { return m_visible; };  // xy: origin, z: layer
+
+    // Heights (w) and normals (xyz) of one tile, (resolution + 1)^2 texels with z fastest
+    static std::vector<glm::vec4> generateTile(const Params &params, glm::ivec2 tile, glm::vec2 &heightBounds);
+
+private:
+    using Key = std::pair<int, int>;
+
+    struct ReadyTile {
+        Key key;
+        std::vector<glm::vec4> texels;
+        glm::vec2 heightBounds;
+    };
+    // Shared with the worker jobs, which may outlive this object
+    struct Pending {
+        std::mutex mutex;
+        std::vector<ReadyTile> ready;
+        std::atomic<bool> cancelled = false;
+    };
+
+    struct Resident {
+        int layer;
+        glm::vec2 heightBounds;
+        std::list<Key>::iterator lruPosition;
+    };
+
+    Params m_params;
+    GLuint m_texture = 0;
+    GLuint m_pbo = 0;
+    char *m_pboMemory = nullptr;
+    GLsync m_pboFences[PBO_SLOTS] = {};
+    int m_nextPboSlot = 0;
+    size_t m_tileBytes;
+
+    std::shared_ptr<Pending> m_pending;
+    std::set<Key> m_requested;          // queued on a worker or waiting for upload
+    std::map<Key, Resident> m_resident;
+    std::list<Key> m_lru;               // front: most recently wanted
+    std::vector<int> m_freeLayers;
+    std::vector<glm::vec4> m_visible;
+
+    void request(Key key);
+    bool upload(ReadyTile &tile, const std::set<Key> &wanted);
+    int allocateLayer(const std::set<Key> &wanted);
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "glm.hpp"
+
+// View frustum of a projView matrix, for culling axis-aligned boxes in the space the matrix maps from.
+struct Frustum {
+    glm::vec4 planes[6];  // Gribb-Hartmann planes, inside where dot(plane, (p, 1)) >= 0
+
+    Frustum() = default;
+    explicit Frustum(const glm::mat4 &projView) {
+        for (int i = 0; i < 3; i++) {
+            for (int sign : {-1, 1}) {
+                glm::vec4 &plane = planes[2 * i + (sign > 0)];
+                for (int col = 0; col < 4; col++)
+                    plane[col] = projView[col][3] + sign * projView[col][i];
+            }
+        }
+    }
+
+    // Conservative: true for every box that touches the frustum, and for a few near its corners
+    bool intersects(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const {
+        for (const glm::vec4 &plane : planes) {
+            // corner furthest along the plane normal
+            const glm::vec3 p(plane.x > 0 ? boxMax.x : boxMin.x,
+                              plane.y > 0 ? boxMax.y : boxMin.y,
+                              plane.z > 0 ? boxMax.z : boxMin.z);
+            if (glm::dot(glm::vec3(plane), p) + plane.w < 0)
+                return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "imgui.h"
+
+/* CPU and GPU time of named scopes (render passes, bakes), per frame and without stalling the pipeline.
+ * Each scope writes a GL_TIMESTAMP query at its start and end; the queries of a frame are read back
+ * FRAMES_IN_FLIGHT frames later, when the GPU has long finished them. Timestamps rather than
+ * GL_TIME_ELAPSED because elapsed-time queries cannot be nested and scopes can (a bake inside a frame).
+ *
+ *   {
+ *       auto scope = m_profiler.scope("terrain");
+ *       drawTerrain();
+ *   }
+ *
+ * newFrame() closes the frame so far; a scope outside paintGL (settingsChanged, initialization) counts
+ * toward the frame that follows it.
+ */
+class GpuProfiler {
+public:
+    static constexpr int FRAMES_IN_FLIGHT = 3;
+    static constexpr int HISTORY = 240;        // frames in the rolling plots
+    static constexpr int TRACE_FRAMES = 1200;  // frames kept for exportCSV / exportTrace
+
+    class Scope {
+    public:
+        Scope(GpuProfiler &profiler, const char *name)
+            : profiler(&profiler), index(profiler.begin(name)), frame(profiler.frames[profiler.current].index) {}
+        ~Scope() { if (profiler) profiler->end(index, frame); }
+        Scope(Scope &&other) noexcept
+            : profiler(std::exchange(other.profiler, nullptr)), index(other.index), frame(other.frame) {}
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+        Scope &operator=(Scope &&) = delete;
+
+    private:
+        GpuProfiler *profiler;
+        size_t index;
+        uint64_t frame;
+    };
+
+    // Time from here to the end of the enclosing block
+    [[nodiscard]] Scope scope(const char *name) { return Scope(*this, name); }
+
+    // Close the current frame and start the next; reads back the frame issued FRAMES_IN_FLIGHT frames ago
+    void newFrame() {
+        Frame &frame = frames[current];
+        if (frame.open) {
+            end(frame.frameScope, frame.index);
+            frame.open = false;
+        }
+        current = (current + 1) % FRAMES_IN_FLIGHT;
+        resolve(frames[current]);
+
+        Frame &next = frames[current];
+        next.samples.clear();
+        next.queriesUsed = 0;
+        next.depth = 0;
+        next.index = frameCount++;
+        next.open = true;
+        next.frameScope = begin("frame");
+    }
+
+    // Delete the queries; the profiler starts over at the next scope
+    void release() {
+        for (Frame &frame : frames) {
+            if (!frame.queries.empty())
+                glDeleteQueries(GLsizei(frame.queries.size()), frame.queries.data());
+            frame = Frame();
+        }
+    }
+
+    struct PassStats {
+        std::string name;
+        int depth = 0;
+        std::array<float, HISTORY> cpuMs{}, gpuMs{};  // ring buffers, newest at PassStats::head
+        int head = 0;
+        float cpuAvg = 0.f, gpuAvg = 0.f;             // exponential moving averages
+        uint64_t lastFrame = 0;                       // frame this pass last ran in
+    };
+
+    const std::vector<PassStats> &getPasses() const { return passes; }
+
+    // One row per scope and frame: frame,pass,depth,cpu_ms,gpu_ms
+    bool exportCSV(const std::string &path) const {
+        std::ofstream out(path, std::ios::trunc);
+        out << "frame,pass,depth,cpu_ms,gpu_ms\n";
+        for (const TraceFrame &frame : trace) {
+            for (const TraceEvent &event : frame.events) {
+                out << frame.index << ',' << event.name << ',' << event.depth << ','
+                    << event.cpuEnd - event.cpuBegin << ',' << (event.gpuEnd - event.gpuBegin) * 1e-6 << '\n';
+            }
+        }
+        return bool(out);
+    }
+
+    // Chrome trace event format (chrome://tracing, Perfetto): CPU scopes on one track, GPU scopes on another
+    bool exportTrace(const std::string &path) const {
+        std::ofstream out(path, std::ios::trunc);
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        const double gpuOrigin = trace.empty() || trace.front().events.empty() ? 0.0 : double(trace.front().events[0].gpuBegin);
+        const double cpuOrigin = trace.empty() || trace.front().events.empty() ? 0.0 : trace.front().events[0].cpuBegin;
+        auto event = [&](const TraceEvent &e, int tid, double ts, double dur) {
+            out << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+                << ",\"ts\":" << ts << ",\"dur\":" << dur << '}';
+            first = false;
+        };
+        for (const TraceFrame &frame : trace) {
+            for (const TraceEvent &e : frame.events) {
+                event(e, 0, (e.cpuBegin - cpuOrigin) * 1e3, (e.cpuEnd - e.cpuBegin) * 1e3);
+                event(e, 1, (double(e.gpuBegin) - gpuOrigin) * 1e-3, double(e.gpuEnd - e.gpuBegin) * 1e-3);
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"tids\":\"0 = CPU, 1 = GPU\"}}\n";
+        return bool(out);
+    }
+
+    // ImGui window with the latest averages and a rolling GPU histogram per pass, scaled to the frame budget
+    void drawOverlay(float budgetMs, const std::string &exportPath) {
+        ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowBgAlpha(0.8f);
+        if (!ImGui::Begin("GPU profiler")) {
+            ImGui::End();
+            return;
+        }
+        ImGui::Text("budget %.2f ms", budgetMs);
+        if (ImGui::BeginTable("passes", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("pass");
+            ImGui::TableSetupColumn("CPU ms");
+            ImGui::TableSetupColumn("GPU ms");
+            ImGui::TableSetupColumn("GPU history", ImGuiTableColumnFlags_WidthStretch);
+            ImGui::TableHeadersRow();
+            for (const PassStats &pass : passes) {
+                if (frameCount - pass.lastFrame > HISTORY) continue;  // e.g. a bake that ran at startup
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%*s%s", pass.depth * 2, "", pass.name.c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%6.2f", pass.cpuAvg);
+                ImGui::TableNextColumn();
+                const bool overBudget = pass.gpuAvg > budgetMs;
+                if (overBudget) ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(255, 96, 96, 255));
+                ImGui::Text("%6.2f", pass.gpuAvg);
+                if (overBudget) ImGui::PopStyleColor();
+                ImGui::TableNextColumn();
+                ImGui::PushID(pass.name.c_str());
+                ImGui::PlotHistogram("", pass.gpuMs.data(), HISTORY, pass.head, nullptr, 0.f,
+                                     pass.depth == 0 ? budgetMs : budgetMs * 0.5f, ImVec2(-1, 24));
+                ImGui::PopID();
+            }
+            ImGui::EndTable();
+        }
+        if (ImGui::Button("Export CSV"))
+            exportCSV(exportPath + ".csv");
+        ImGui::SameLine();
+        if (ImGui::Button("Export trace JSON"))
+            exportTrace(exportPath + ".json");
+        ImGui::End();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Sample {
+        const char *name;
+        int depth;
+        GLuint beginQuery = 0, endQuery = 0;  // indices into Frame::queries
+        double cpuBegin = 0, cpuEnd = 0;      // ms since the profiler started
+        bool closed = false;
+    };
+
+    struct Frame {
+        std::vector<GLuint> queries;  // grown on demand and reused, never shrunk
+        GLuint queriesUsed = 0;
+        std::vector<Sample> samples;
+        int depth = 0;
+        uint64_t index = 0;
+        size_t frameScope = 0;  // the "frame" sample of newFrame, when open
+        bool open = false;
+    };
+
+    struct TraceEvent {
+        std::string name;
+        int depth;
+        double cpuBegin, cpuEnd;
+        GLuint64 gpuBegin, gpuEnd;  // ns
+    };
+
+    struct TraceFrame {
+        uint64_t index;
+        std::vector<TraceEvent> events;
+    };
+
+    double cpuNow() const { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); }
+
+    GLuint timestamp(Frame &frame) {
+        if (frame.queriesUsed == frame.queries.size()) {
+            frame.queries.resize(std::max<size_t>(16, frame.queries.size() * 2));
+            glGenQueries(GLsizei(frame.queries.size() - frame.queriesUsed), frame.queries.data() + frame.queriesUsed);
+        }
+        glQueryCounter(frame.queries[frame.queriesUsed], GL_TIMESTAMP);
+        return frame.queriesUsed++;
+    }
+
+    size_t begin(const char *name) {
+        Frame &frame = frames[current];
+        Sample sample{name, frame.depth++};
+        sample.beginQuery = timestamp(frame);
+        sample.cpuBegin = cpuNow();
+        frame.samples.push_back(sample);
+        return frame.samples.size() - 1;
+    }
+
+    void end(size_t index, uint64_t frameIndex) {
+        Frame &frame = frames[current];
+        if (frame.index != frameIndex || frame.samples[index].closed) return;  // newFrame ran inside the scope
+        Sample &sample = frame.samples[index];
+        sample.endQuery = timestamp(frame);
+        sample.cpuEnd = cpuNow();
+        sample.closed = true;
+        frame.depth--;
+    }
+
+    // Never blocks: a frame whose queries are still in flight is dropped instead
+    void resolve(Frame &frame) {
+        if (frame.samples.empty()) return;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(frame.queries[frame.queriesUsed - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+
+        TraceFrame traced{frame.index, {}};
+        for (const Sample &sample : frame.samples) {
+            if (!sample.closed) continue;
+            GLuint64 gpuBegin = 0, gpuEnd = 0;
+            glGetQueryObjectui64v(frame.queries[sample.beginQuery], GL_QUERY_RESULT, &gpuBegin);
+            glGetQueryObjectui64v(frame.queries[sample.endQuery], GL_QUERY_RESULT, &gpuEnd);
+            record(sample.name, sample.depth, float(sample.cpuEnd - sample.cpuBegin), float((gpuEnd - gpuBegin) * 1e-6),
+                   frame.index);
+            traced.events.push_back({sample.name, sample.depth, sample.cpuBegin, sample.cpuEnd, gpuBegin, gpuEnd});
+        }
+        trace.push_back(std::move(traced));
+        if (trace.size() > size_t(TRACE_FRAMES)) trace.pop_front();
+    }
+
+    // A pass that runs several times in a frame (e.g. one dispatch per channel) adds up
+    void record(const std::string &name, int depth, float cpuMs, float gpuMs, uint64_t frameIndex) {
+        auto it = std::find_if(passes.begin(), passes.end(),
+                               [&](const PassStats &pass) { return pass.name == name && pass.depth == depth; });
+        if (it == passes.end()) {
+            passes.push_back({name, depth});
+            it = passes.end() - 1;
+            it->cpuAvg = cpuMs;
+            it->gpuAvg = gpuMs;
+        } else if (it->lastFrame == frameIndex) {
+            it->cpuMs[it->head] += cpuMs;
+            it->gpuMs[it->head] += gpuMs;
+            it->cpuAvg += cpuMs * 0.05f;
+            it->gpuAvg += gpuMs * 0.05f;
+            return;
+        }
+        it->head = (it->head + 1) % HISTORY;
+        it->cpuMs[it->head] = cpuMs;
+        it->gpuMs[it->head] = gpuMs;
+        it->cpuAvg += (cpuMs - it->cpuAvg) * 0.05f;
+        it->gpuAvg += (gpuMs - it->gpuAvg) * 0.05f;
+        it->lastFrame = frameIndex;
+    }
+
+    std::array<Frame, FRAMES_IN_FLIGHT> frames;
+    int current = 0;
+    uint64_t frameCount = 1;  // frame 0 is everything before the first newFrame
+    std::vector<PassStats> passes;  // in first-seen order, which is draw order
+    std::deque<TraceFrame> trace;
+    Clock::time_point start = Clock::now();
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// FNV-1a, stable across runs and platforms (std::hash is not), for naming on-disk cache entries
+struct Fnv1a {
+    uint64_t value = 0xcbf29ce484222325ull;
+
+    void add(const void *data, size_t size) {
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++) {
+            value ^= bytes[i];
+            value *= 0x100000001b3ull;
+        }
+    }
+
+    void add(const std::string &s) {
+        add(s.size());
+        add(s.data(), s.size());
+    }
+
+    template <typename T>
+    void add(const T &v) { add(&v, sizeof(T)); }
+};
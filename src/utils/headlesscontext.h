@@ -0,0 +1,78 @@
+#pragma once
+
+#ifdef HEADLESS_EGL  // set by the CMake build, see CMakeLists.txt
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstdlib>
+#include <iostream>
+
+/* OpenGL 4.6 core context without a display server, for benchmarks and regression renders on servers.
+ * Uses Mesa's surfaceless EGL platform (falls back to the default display), so it runs on llvmpipe with
+ * no GPU at all. A pbuffer of the requested size stands in for the window: it is the default framebuffer
+ * paintGL ends in, so frames can be read back with glReadPixels.
+ * GLEW has to be built with GLEW_EGL for glewInit to find the entry points through EGL.
+ */
+class HeadlessContext {
+public:
+    HeadlessContext(int width, int height) {
+        // llvmpipe reports 4.5; the shaders only need what it already implements
+        setenv("MESA_GL_VERSION_OVERRIDE", "4.6", 0);
+        setenv("MESA_GLSL_VERSION_OVERRIDE", "460", 0);
+
+        auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+            std::cerr << "Headless: no EGL display" << std::endl;
+            return;
+        }
+        eglBindAPI(EGL_OPENGL_API);
+
+        const EGLint configAttribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24,
+                                        EGL_NONE};
+        EGLConfig config;
+        EGLint numConfigs = 0;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+            std::cerr << "Headless: no pbuffer config" << std::endl;
+            return;
+        }
+        const EGLint surfaceAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+        surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+        const EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 6,
+                                         EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                         EGL_NONE};
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+        if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT
+            || !eglMakeCurrent(display, surface, surface, context)) {
+            std::cerr << "Headless: could not create a 4.6 context (EGL error 0x" << std::hex << eglGetError()
+                      << std::dec << ")" << std::endl;
+            return;
+        }
+        current = true;
+    }
+
+    ~HeadlessContext() {
+        if (display == EGL_NO_DISPLAY) return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+        if (surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+        eglTerminate(display);
+    }
+
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+    bool isCurrent() const { return current; }
+
+private:
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+    bool current = false;
+};
+#endif
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Just enough JSON for the benchmark scripts: objects, arrays, numbers, strings, booleans and null.
+ * No \u escapes beyond ASCII, no streaming; parse() throws std::runtime_error with the offending offset.
+ */
+struct Json {
+    enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<Json> items;         // ARRAY elements, OBJECT values
+    std::vector<std::string> keys;   // OBJECT keys, parallel to items
+
+    static Json parse(const std::string &text) {
+        size_t pos = 0;
+        Json value = parseValue(text, pos);
+        skipSpace(text, pos);
+        if (pos != text.size()) fail(pos, "trailing characters");
+        return value;
+    }
+
+    const Json *find(const std::string &key) const {
+        for (size_t i = 0; i < keys.size(); i++)
+            if (keys[i] == key) return &items[i];
+        return nullptr;
+    }
+
+    double getNumber(const std::string &key, double fallback) const {
+        const Json *value = find(key);
+        return value && value->type == NUMBER ? value->number : fallback;
+    }
+
+    std::string getString(const std::string &key, const std::string &fallback) const {
+        const Json *value = find(key);
+        return value && value->type == STRING ? value->string : fallback;
+    }
+
+    bool getBool(const std::string &key, bool fallback) const {
+        const Json *value = find(key);
+        return value && value->type == BOOLEAN ? value->boolean : fallback;
+    }
+
+private:
+    [[noreturn]] static void fail(size_t pos, const std::string &what) {
+        throw std::runtime_error("JSON parse error at offset " + std::to_string(pos) + ": " + what);
+    }
+
+    static void skipSpace(const std::string &text, size_t &pos) {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+            pos++;
+    }
+
+    static void expect(const std::string &text, size_t &pos, const char *literal) {
+        for (const char *c = literal; *c; c++, pos++)
+            if (pos >= text.size() || text[pos] != *c) fail(pos, std::string("expected ") + literal);
+    }
+
+    static std::string parseString(const std::string &text, size_t &pos) {
+        expect(text, pos, "\"");
+        std::string result;
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c == '\\') {
+                if (pos >= text.size()) break;
+                switch (char e = text[pos++]) {
+                    case 'n': result += '\n'; break;
+                    case 't': result += '\t'; break;
+                    case 'r': result += '\r'; break;
+                    case 'b': result += '\b'; break;
+                    case 'f': result += '\f'; break;
+                    case 'u': {
+                        if (pos + 4 > text.size()) fail(pos, "truncated \\u escape");
+                        long code = std::strtol(text.substr(pos, 4).c_str(), nullptr, 16);
+                        result += code < 0x80 ? char(code) : '?';
+                        pos += 4;
+                        break;
+                    }
+                    default: result += e; break;  // \" \\ \/
+                }
+            } else {
+                result += c;
+            }
+        }
+        expect(text, pos, "\"");
+        return result;
+    }
+
+    static Json parseValue(const std::string &text, size_t &pos) {
+        skipSpace(text, pos);
+        if (pos >= text.size()) fail(pos, "unexpected end");
+        Json value;
+        switch (text[pos]) {
+            case '{':
+                value.type = OBJECT;
+                pos++;
+                skipSpace(text, pos);
+                if (pos < text.size() && text[pos] == '}') { pos++; break; }
+                while (true) {
+                    skipSpace(text, pos);
+                    value.keys.push_back(parseString(text, pos));
+                    skipSpace(text, pos);
+                    expect(text, pos, ":");
+                    value.items.push_back(parseValue(text, pos));
+                    skipSpace(text, pos);
+                    if (pos < text.size() && text[pos] == ',') { pos++; continue; }
+                    expect(text, pos, "}");
+                    break;
+                }
+                break;
+            case '[':
+                value.type = ARRAY;
+                pos++;
+                skipSpace(text, pos);
+                if (pos < text.size() && text[pos] == ']') { pos++; break; }
+                while (true) {
+                    value.items.push_back(parseValue(text, pos));
+                    skipSpace(text, pos);
+                    if (pos < text.size() && text[pos] == ',') { pos++; continue; }
+                    expect(text, pos, "]");
+                    break;
+                }
+                break;
+            case '"':
+                value.type = STRING;
+                value.string = parseString(text, pos);
+                break;
+            case 't': value.type = BOOLEAN; value.boolean = true; expect(text, pos, "true"); break;
+            case 'f': value.type = BOOLEAN; expect(text, pos, "false"); break;
+            case 'n': expect(text, pos, "null"); break;
+            default: {
+                const char *begin = text.c_str() + pos;
+                char *end = nullptr;
+                value.type = NUMBER;
+                value.number = std::strtod(begin, &end);
+                if (end == begin) fail(pos, "unexpected character");
+                pos += size_t(end - begin);
+            }
+        }
+        return value;
+    }
+};
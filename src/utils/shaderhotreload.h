@@ -0,0 +1,232 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "shaderloader.h"
+
+#ifdef SHADER_HOT_RELOAD_INOTIFY
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/* Rebuilds programs whose source files (or anything they #include) change on disk, for look-dev without
+ * restarting the app. Changes come from inotify when built with SHADER_HOT_RELOAD_INOTIFY (Linux only) and
+ * from polling modification times otherwise, e.g. in the vcxproj build.
+ * A rebuild is only submitted to the driver; the old program keeps rendering until the new one has linked
+ * and is then swapped into the same slot between frames. A build that fails is reported and dropped, the
+ * old program stays.
+ */
+class ShaderHotReload {
+public:
+    using StageFiles = std::vector<std::pair<GLenum, std::string>>;
+
+    explicit ShaderHotReload(const std::string &directory) : directory(directory) {
+#ifdef SHADER_HOT_RELOAD_INOTIFY
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0 && inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            close(inotifyFd);
+            inotifyFd = -1;
+        }
+        if (inotifyFd < 0)
+            std::cerr << "Shader hot reload: inotify unavailable, polling " << directory << std::endl;
+#endif
+    }
+
+    ~ShaderHotReload() {
+        for (Build &build : builds)
+            discard(build);
+#ifdef SHADER_HOT_RELOAD_INOTIFY
+        if (inotifyFd >= 0) close(inotifyFd);
+#endif
+    }
+
+    ShaderHotReload(const ShaderHotReload &) = delete;
+    ShaderHotReload &operator=(const ShaderHotReload &) = delete;
+
+    // program is overwritten with the rebuilt one; onSwap runs with it in use, for uniforms set once at creation.
+    // Watching the same slot again replaces its files and defines (e.g. after the slot was recreated differently).
+    void watch(GLuint *program, StageFiles files, std::string defines = "",
+               std::function<void(GLuint)> onSwap = nullptr) {
+        Source source;
+        source.files = std::move(files);
+        source.defines = std::move(defines);
+        source.onSwap = std::move(onSwap);
+        source.slot = [program](const std::string &) { return program; };
+        sources[program] = std::move(source);
+        rescan(sources[program]);
+    }
+
+    // Every variant built so far is rebuilt with its own defines
+    void watch(ShaderPermutations *permutations) {
+        Source source;
+        source.files = permutations->stageFiles();
+        source.onSwap = permutations->initializer();
+        source.permutations = permutations;
+        source.slot = [permutations](const std::string &defines) { return permutations->find(defines); };
+        sources[permutations] = std::move(source);
+        rescan(sources[permutations]);
+    }
+
+    // Once per frame from the render thread. Returns the slots that now hold a new program.
+    std::vector<GLuint *> update() {
+        const std::set<std::string> changed = changedFiles();
+        for (auto &[owner, source] : sources) {
+            bool affected = false;
+            for (const std::string &file : source.dependencies)
+                affected |= changed.count(file) > 0;
+            if (!affected) continue;
+            rescan(source);  // an edit may have added or removed an #include
+            if (source.permutations) {
+                for (const std::string &defines : source.permutations->variants())
+                    start(owner, source, defines);
+            } else {
+                start(owner, source, source.defines);
+            }
+        }
+
+        std::vector<GLuint *> swapped;
+        for (auto it = builds.begin(); it != builds.end();) {
+            if (!ShaderLoader::isProgramReady(it->pending)) {
+                ++it;
+                continue;
+            }
+            if (GLuint *slot = finish(*it))
+                swapped.push_back(slot);
+            it = builds.erase(it);
+        }
+        return swapped;
+    }
+
+private:
+    struct Source {
+        StageFiles files;
+        std::string defines;
+        std::function<void(GLuint)> onSwap;
+        std::function<GLuint *(const std::string &defines)> slot;
+        ShaderPermutations *permutations = nullptr;
+        std::set<std::string> dependencies;  // normalized paths of the stage files and their includes
+        std::map<std::string, std::filesystem::file_time_type> writeTimes;  // for polling
+    };
+
+    struct Build {
+        const void *owner;
+        std::string defines;
+        ShaderLoader::PendingProgram pending;
+    };
+
+    static std::string normalize(const std::string &path) {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+
+    static std::filesystem::file_time_type writeTime(const std::string &path) {
+        std::error_code ec;
+        auto time = std::filesystem::last_write_time(path, ec);
+        return ec ? std::filesystem::file_time_type::min() : time;
+    }
+
+    void rescan(Source &source) {
+        source.dependencies.clear();
+        for (const auto &[type, path] : source.files) {
+            for (const std::string &file : ShaderLoader::sourceFiles(path)) {
+                const std::string normalized = normalize(file);
+                source.dependencies.insert(normalized);
+                source.writeTimes.try_emplace(normalized, writeTime(normalized));
+            }
+        }
+    }
+
+    std::set<std::string> changedFiles() {
+        std::set<std::string> changed;
+#ifdef SHADER_HOT_RELOAD_INOTIFY
+        if (inotifyFd >= 0) {
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char *ptr = buffer; ptr < buffer + length;) {
+                    const auto *event = reinterpret_cast<const inotify_event *>(ptr);
+                    if (event->len > 0)
+                        changed.insert(normalize(directory + "/" + event->name));
+                    ptr += sizeof(inotify_event) + event->len;
+                }
+            }
+            return changed;
+        }
+#endif
+        // A stat per watched file is cheap, but there is no need to do it every frame
+        const auto now = std::chrono::steady_clock::now();
+        if (now - lastPoll < std::chrono::milliseconds(250)) return changed;
+        lastPoll = now;
+        for (auto &[owner, source] : sources) {
+            for (auto &[file, time] : source.writeTimes) {
+                const auto current = writeTime(file);
+                if (current != time) {
+                    time = current;
+                    changed.insert(file);
+                }
+            }
+        }
+        return changed;
+    }
+
+    // A newer edit supersedes a build of the same program that has not finished yet
+    void start(const void *owner, const Source &source, const std::string &defines) {
+        for (auto it = builds.begin(); it != builds.end(); ++it) {
+            if (it->owner == owner && it->defines == defines) {
+                discard(*it);
+                builds.erase(it);
+                break;
+            }
+        }
+        builds.push_back({owner, defines, ShaderLoader::beginProgram(source.files, defines)});
+    }
+
+    static void discard(Build &build) {
+        std::string log;
+        if (GLuint program = ShaderLoader::finishProgram(build.pending, log))
+            glDeleteProgram(program);
+    }
+
+    // The slot that received the new program, nullptr if the build failed or its slot is gone
+    GLuint *finish(Build &build) {
+        auto source = sources.find(build.owner);
+        std::string log;
+        const GLuint program = ShaderLoader::finishProgram(build.pending, log);
+        const std::string name = source == sources.end() ? "" : source->second.files.back().second;
+        if (!program) {
+            std::cerr << "Shader reload failed for " << name << ", keeping the previous program:\n"
+                      << log << std::endl;
+            return nullptr;
+        }
+        GLuint *slot = source == sources.end() ? nullptr : source->second.slot(build.defines);
+        if (!slot) {
+            glDeleteProgram(program);
+            return nullptr;
+        }
+        if (source->second.onSwap) {
+            GLint current = 0;
+            glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+            glUseProgram(program);
+            source->second.onSwap(program);
+            glUseProgram(GLuint(current) == *slot ? program : GLuint(current));
+        }
+        glDeleteProgram(*slot);
+        *slot = program;
+        std::cout << "Reloaded " << name << std::endl;
+        return slot;
+    }
+
+    std::string directory;
+    std::map<const void *, Source> sources;  // by watched slot or ShaderPermutations
+    std::vector<Build> builds;  // submitted to the driver, not yet swapped in
+    std::chrono::steady_clock::time_point lastPoll;
+#ifdef SHADER_HOT_RELOAD_INOTIFY
+    int inotifyFd = -1;
+#endif
+};
@@ -4,63 +4,297 @@
 #define GL_SILENCE_DEPRECATION
 #endif
 #include <GL/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
 #include <fstream>
+#include <map>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
+#include "hash.h"
+
+// GL_KHR_parallel_shader_compile postdates the GLEW headers we build against
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 class ShaderLoader {
 public:
-    static GLuint createShaderProgram(const char *vertex_file_path, const char *fragment_file_path) {
-        // Create and compile the shaders.
-        GLuint vertexShaderID = createShader(GL_VERTEX_SHADER, vertex_file_path);
-        GLuint fragmentShaderID = createShader(GL_FRAGMENT_SHADER, fragment_file_path);
+    // Directory for linked program binaries (see loadProgramBinary), empty to always compile from source
+    static void setBinaryCacheDir(const std::string &directory) { binaryCacheDir() = directory; }
 
-        // Link the shader program.
-        GLuint programID = glCreateProgram();
-        glAttachShader(programID, vertexShaderID);
-        glAttachShader(programID, fragmentShaderID);
-        glLinkProgram(programID);
+    // defines: extra preprocessor lines (e.g. "#define FOO 1\n") inserted right after #version,
+    // so one source file can be compiled into several variants
+    static GLuint createShaderProgram(const char *vertex_file_path, const char *fragment_file_path,
+                                      const std::string &defines = "") {
+        return createProgram({{GL_VERTEX_SHADER, readSource(vertex_file_path, defines)},
+                              {GL_FRAGMENT_SHADER, readSource(fragment_file_path, defines)}});
+    }
 
-        // Check for linking errors
-        checkLinkStatus(programID);
+    static GLuint createComputeShaderProgram(const char *compute_file_path, const std::string &defines = "") {
+        return createProgram({{GL_COMPUTE_SHADER, readSource(compute_file_path, defines)}});
+    }
 
-        // Shaders no longer necessary, stored in program
-        glDeleteShader(vertexShaderID);
-        glDeleteShader(fragmentShaderID);
+    // The text a shader file is compiled from, includes resolved, for caches keyed on what its program produces
+    static std::string sourceText(const char *filepath) {
+        return resolveIncludes(readFile(filepath), filepath);
+    }
+
+    /* Non-blocking build for reloading shaders while the app runs: beginProgram only submits compile and link,
+     * isProgramReady polls GL_KHR_parallel_shader_compile so the render thread never waits on the compiler,
+     * finishProgram returns 0 and the info log instead of throwing, so a typo never takes the app down.
+     * Without the extension isProgramReady is always true and the driver compiles on first query instead.
+     */
+    struct PendingProgram {
+        GLuint program = 0;
+        std::vector<GLuint> shaders;
+        uint64_t key = 0;  // binary cache key, 0 when the cache is off
+        std::string error;  // set when a source file could not be read
+    };
 
+    static PendingProgram beginProgram(const std::vector<std::pair<GLenum, std::string>> &files,
+                                       const std::string &defines = "") {
+        PendingProgram pending;
+        std::vector<Stage> stages;
+        try {
+            for (const auto &[type, path] : files)
+                stages.push_back({type, readSource(path.c_str(), defines)});
+        } catch (const std::runtime_error &e) {
+            pending.error = e.what();
+            return pending;
+        }
+        if (!binaryCacheDir().empty() && binaryFormatsSupported())
+            pending.key = binaryKey(stages);
+
+        pending.program = glCreateProgram();
+        if (pending.key)
+            glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        for (const Stage &stage : stages) {
+            pending.shaders.push_back(compileShader(stage.type, stage.code));
+            glAttachShader(pending.program, pending.shaders.back());
+        }
+        glLinkProgram(pending.program);
+        return pending;
+    }
+
+    static bool isProgramReady(const PendingProgram &pending) {
+        if (!pending.program || !parallelCompileSupported()) return true;
+        GLint done = GL_TRUE;
+        glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+
+    // The linked program, or 0 with the compiler/linker output in log
+    static GLuint finishProgram(PendingProgram &pending, std::string &log) {
+        if (!pending.program) {
+            log = pending.error;
+            return 0;
+        }
+        for (GLuint shaderID : pending.shaders) {
+            GLint status = GL_FALSE;
+            glGetShaderiv(shaderID, GL_COMPILE_STATUS, &status);
+            if (status == GL_FALSE)
+                log += shaderInfoLog(shaderID);
+        }
+        GLint status = GL_FALSE;
+        glGetProgramiv(pending.program, GL_LINK_STATUS, &status);
+        if (log.empty() && status == GL_FALSE)
+            log = programInfoLog(pending.program);
+
+        for (GLuint shaderID : pending.shaders) {
+            glDetachShader(pending.program, shaderID);
+            glDeleteShader(shaderID);
+        }
+        pending.shaders.clear();
+        GLuint programID = std::exchange(pending.program, 0);
+        if (!log.empty()) {
+            glDeleteProgram(programID);
+            return 0;
+        }
+        if (pending.key)
+            storeProgramBinary(pending.key, programID);
         return programID;
     }
 
-    static GLuint createComputeShaderProgram(const char *compute_file_path) {
-        // Create and compile the shader.
-        GLuint computeShaderID = createShader(GL_COMPUTE_SHADER, compute_file_path);
+    // The file and everything it #includes, for deciding which programs a changed file affects
+    static std::vector<std::string> sourceFiles(const std::string &filepath) {
+        std::vector<std::string> files;
+        collectSourceFiles(filepath, files, 0);
+        return files;
+    }
+
+    static bool parallelCompileSupported() {
+        static const bool supported = [] {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++) {
+                const GLubyte *name = glGetStringi(GL_EXTENSIONS, GLuint(i));
+                if (name && std::strcmp(reinterpret_cast<const char *>(name), "GL_KHR_parallel_shader_compile") == 0)
+                    return true;
+            }
+            return false;
+        }();
+        return supported;
+    }
+
+private:
+    static constexpr uint32_t BINARY_CACHE_VERSION = 1;  // bump when the entry layout changes
+    static constexpr char BINARY_CACHE_MAGIC[4] = {'C', 'P', 'R', 'G'};
+
+    struct Stage {
+        GLenum type;
+        std::string code;  // includes resolved and defines injected, exactly what gets compiled
+    };
+
+    struct BinaryHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t format;  // driver-specific binary format from glGetProgramBinary
+        uint32_t length;
+    };
+
+    static std::string &binaryCacheDir() {
+        static std::string directory;
+        return directory;
+    }
+
+    static std::string readSource(const char *filepath, const std::string &defines) {
+        return injectDefines(resolveIncludes(readFile(filepath), filepath), defines);
+    }
+
+    // Program binaries from the cache when the driver accepts them, otherwise compiled and linked from source
+    static GLuint createProgram(const std::vector<Stage> &stages) {
+        const bool useCache = !binaryCacheDir().empty() && binaryFormatsSupported();
+        const uint64_t key = useCache ? binaryKey(stages) : 0;
+        if (useCache) {
+            if (GLuint programID = loadProgramBinary(key))
+                return programID;
+        }
+
+        // Create and compile the shaders.
+        std::vector<GLuint> shaderIDs;
+        for (const Stage &stage : stages)
+            shaderIDs.push_back(createShader(stage.type, stage.code));
 
         // Link the shader program.
         GLuint programID = glCreateProgram();
-        glAttachShader(programID, computeShaderID);
+        if (useCache)
+            glProgramParameteri(programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        for (GLuint shaderID : shaderIDs)
+            glAttachShader(programID, shaderID);
         glLinkProgram(programID);
 
+        // Shaders no longer necessary, stored in program
+        for (GLuint shaderID : shaderIDs) {
+            glDetachShader(programID, shaderID);
+            glDeleteShader(shaderID);
+        }
+
         // Check for linking errors
         checkLinkStatus(programID);
 
-        // Shader no longer necessary, stored in program
-        glDeleteShader(computeShaderID);
+        if (useCache)
+            storeProgramBinary(key, programID);
+        return programID;
+    }
+
+    static bool binaryFormatsSupported() {
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        return numFormats > 0;
+    }
+
+    // Hash of every stage's final source and of the driver, since binaries only load on the driver that made them
+    static uint64_t binaryKey(const std::vector<Stage> &stages) {
+        Fnv1a hash;
+        hash.add(BINARY_CACHE_VERSION);
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const GLubyte *value = glGetString(name);
+            hash.add(std::string(value ? reinterpret_cast<const char *>(value) : ""));
+        }
+        for (const Stage &stage : stages) {
+            hash.add(uint32_t(stage.type));
+            hash.add(stage.code);
+        }
+        return hash.value;
+    }
+
+    static std::string binaryPath(uint64_t key) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "program_%016llx.bin", static_cast<unsigned long long>(key));
+        return (std::filesystem::path(binaryCacheDir()) / name).string();
+    }
 
+    // 0 on a miss, a corrupt entry, or a binary the driver rejects (e.g. after a driver update)
+    static GLuint loadProgramBinary(uint64_t key) {
+        std::ifstream in(binaryPath(key), std::ios::binary);
+        BinaryHeader header;
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))) return 0;
+        if (std::memcmp(header.magic, BINARY_CACHE_MAGIC, sizeof(BINARY_CACHE_MAGIC)) != 0
+            || header.version != BINARY_CACHE_VERSION || header.key != key) {
+            return 0;
+        }
+        std::vector<char> binary(header.length);
+        if (!in.read(binary.data(), std::streamsize(binary.size()))) return 0;
+
+        GLuint programID = glCreateProgram();
+        glProgramBinary(programID, header.format, binary.data(), GLsizei(binary.size()));
+        GLint status = GL_FALSE;
+        glGetProgramiv(programID, GL_LINK_STATUS, &status);
+        if (status == GL_FALSE) {
+            glDeleteProgram(programID);
+            return 0;
+        }
         return programID;
     }
 
-private:
-    static GLuint createShader(GLenum shaderType, const char *filepath) {
-        GLuint shaderID = glCreateShader(shaderType);
+    // Best effort: a failed write only means the next launch compiles again
+    static void storeProgramBinary(uint64_t key, GLuint programID) {
+        GLint length = 0;
+        glGetProgramiv(programID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+        BinaryHeader header;
+        std::memcpy(header.magic, BINARY_CACHE_MAGIC, sizeof(BINARY_CACHE_MAGIC));
+        header.version = BINARY_CACHE_VERSION;
+        header.key = key;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(programID, length, &length, &format, binary.data());
+        header.format = format;
+        header.length = uint32_t(length);
 
-        // Read shader file.
-        std::string code = readFile(filepath);
+        // Write next to the final name and rename, so a crash never leaves a half-written entry behind
+        std::error_code ec;
+        std::filesystem::create_directories(binaryCacheDir(), ec);
+        const std::string path = binaryPath(key);
+        const std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!out) return;
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(binary.data(), length);
+            if (!out) return;
+        }
+        std::filesystem::rename(tmpPath, path, ec);
+    }
 
-        // Compile shader code.
+    static GLuint compileShader(GLenum shaderType, const std::string &code) {
+        GLuint shaderID = glCreateShader(shaderType);
         const char *codePtr = code.c_str();
         glShaderSource(shaderID, 1, &codePtr, nullptr); // Assumes code is null terminated
         glCompileShader(shaderID);
+        return shaderID;
+    }
+
+    static GLuint createShader(GLenum shaderType, const std::string &code) {
+        GLuint shaderID = compileShader(shaderType, code);
 
         // Check for compilation errors
         checkCompileStatus(shaderID);
@@ -68,6 +302,40 @@ private:
         return shaderID;
     }
 
+    static void collectSourceFiles(const std::string &filepath, std::vector<std::string> &files, int depth) {
+        if (depth > 8 || std::find(files.begin(), files.end(), filepath) != files.end()) return;
+        files.push_back(filepath);
+        std::ifstream file(filepath);
+        const std::string directory = filepath.substr(0, filepath.find_last_of("/\\") + 1);
+        std::string line;
+        while (std::getline(file, line)) {
+            size_t pos = line.find_first_not_of(" \t");
+            if (pos == std::string::npos || line.compare(pos, 8, "#include") != 0) continue;
+            size_t open = line.find('"', pos);
+            size_t close = line.find('"', open + 1);
+            if (open != std::string::npos && close != std::string::npos)
+                collectSourceFiles(directory + line.substr(open + 1, close - open - 1), files, depth + 1);
+        }
+    }
+
+    static std::string shaderInfoLog(GLuint shaderID) {
+        GLint length = 0;
+        glGetShaderiv(shaderID, GL_INFO_LOG_LENGTH, &length);
+        std::string log(std::max(length, 1), '\0');
+        glGetShaderInfoLog(shaderID, length, nullptr, &log[0]);
+        log.resize(std::strlen(log.c_str()));
+        return log.empty() ? "shader failed to compile\n" : log;
+    }
+
+    static std::string programInfoLog(GLuint programID) {
+        GLint length = 0;
+        glGetProgramiv(programID, GL_INFO_LOG_LENGTH, &length);
+        std::string log(std::max(length, 1), '\0');
+        glGetProgramInfoLog(programID, length, nullptr, &log[0]);
+        log.resize(std::strlen(log.c_str()));
+        return log.empty() ? "program failed to link\n" : log;
+    }
+
     static std::string readFile(const char *filepath) {
         std::ifstream file(filepath, std::ios::in);
         if (!file.is_open()) {
@@ -79,6 +347,47 @@ private:
         return sstr.str();
     }
 
+    // Replace each line #include "file" with that file, looked up next to the including file.
+    // GLSL has no #include of its own; this lets shaders share code such as cloudDensity.glsl.
+    static std::string resolveIncludes(const std::string &code, const std::string &filepath, int depth = 0) {
+        if (depth > 8)
+            throw std::runtime_error("Shader includes nested too deeply in " + filepath);
+        const std::string directory = filepath.substr(0, filepath.find_last_of("/\\") + 1);
+
+        std::istringstream lines(code);
+        std::string line, result;
+        int lineNum = 0;
+        while (std::getline(lines, line)) {
+            lineNum++;
+            size_t pos = line.find_first_not_of(" \t");
+            if (pos != std::string::npos && line.compare(pos, 8, "#include") == 0) {
+                size_t open = line.find('"', pos);
+                size_t close = line.find('"', open + 1);
+                if (open == std::string::npos || close == std::string::npos)
+                    throw std::runtime_error("Malformed #include in " + filepath + ": " + line);
+                std::string includePath = directory + line.substr(open + 1, close - open - 1);
+                result += "#line 1\n" + resolveIncludes(readFile(includePath.c_str()), includePath, depth + 1);
+                result += "#line " + std::to_string(lineNum + 1) + '\n';
+            } else {
+                result += line + '\n';
+            }
+        }
+        return result;
+    }
+
+    // #version has to stay the first line, so the defines go right below it;
+    // #line keeps compiler messages pointing at the lines of the file on disk
+    static std::string injectDefines(const std::string &code, const std::string &defines) {
+        if (defines.empty()) return code;
+        size_t versionPos = code.find("#version");
+        if (versionPos == std::string::npos) return defines + code;
+        size_t lineEnd = code.find('\n', versionPos);
+        if (lineEnd == std::string::npos) return code + '\n' + defines;
+        int versionLine = 1 + int(std::count(code.begin(), code.begin() + lineEnd, '\n'));
+        return code.substr(0, lineEnd + 1) + defines + "#line " + std::to_string(versionLine + 1) + '\n'
+             + code.substr(lineEnd + 1);
+    }
+
     static void checkCompileStatus(GLuint shaderID) {
         GLint status;
         glGetShaderiv(shaderID, GL_COMPILE_STATUS, &status);
@@ -105,3 +414,81 @@ private:
         }
     }
 };
+
+/* Variants of one shader that differ only in their #define block, so a feature that is switched off
+ * is compiled out instead of branched over. A variant is compiled the first time get() asks for its
+ * defines and kept for later requests; switching back to an earlier combination costs nothing.
+ * onCreate runs once per new variant with the program in use, for uniforms that never change (samplers).
+ */
+class ShaderPermutations {
+public:
+    ShaderPermutations() = default;
+
+    // vertex + fragment shader
+    ShaderPermutations(std::string vertexPath, std::string fragmentPath,
+                       std::function<void(GLuint)> onCreate = nullptr)
+        : vertexPath(std::move(vertexPath)), fragmentPath(std::move(fragmentPath)), onCreate(std::move(onCreate)) {}
+
+    // compute shader
+    static ShaderPermutations compute(std::string computePath, std::function<void(GLuint)> onCreate = nullptr) {
+        ShaderPermutations permutations;
+        permutations.computePath = std::move(computePath);
+        permutations.onCreate = std::move(onCreate);
+        return permutations;
+    }
+
+    GLuint get(const std::string &defines) {
+        auto it = programs.find(defines);
+        if (it != programs.end())
+            return it->second;
+        const GLuint program = computePath.empty()
+                             ? ShaderLoader::createShaderProgram(vertexPath.c_str(), fragmentPath.c_str(), defines)
+                             : ShaderLoader::createComputeShaderProgram(computePath.c_str(), defines);
+        programs.emplace(defines, program);
+        if (onCreate) {
+            GLint current = 0;
+            glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+            glUseProgram(program);
+            onCreate(program);
+            glUseProgram(GLuint(current));
+        }
+        return program;
+    }
+
+    // Every variant built so far, e.g. to update a uniform that all of them share
+    template <typename Func>
+    void forEach(Func func) const {
+        for (const auto &[defines, program] : programs)
+            func(program);
+    }
+
+    void clear() {
+        forEach([](GLuint program) { glDeleteProgram(program); });
+        programs.clear();
+    }
+
+    // Live program of one variant, nullptr once it is gone; lets ShaderHotReload swap variants in place
+    GLuint *find(const std::string &defines) {
+        auto it = programs.find(defines);
+        return it == programs.end() ? nullptr : &it->second;
+    }
+
+    std::vector<std::string> variants() const {
+        std::vector<std::string> result;
+        for (const auto &[defines, program] : programs)
+            result.push_back(defines);
+        return result;
+    }
+
+    std::vector<std::pair<GLenum, std::string>> stageFiles() const {
+        if (!computePath.empty()) return {{GL_COMPUTE_SHADER, computePath}};
+        return {{GL_VERTEX_SHADER, vertexPath}, {GL_FRAGMENT_SHADER, fragmentPath}};
+    }
+
+    const std::function<void(GLuint)> &initializer() const { return onCreate; }
+
+private:
+    std::string vertexPath, fragmentPath, computePath;
+    std::function<void(GLuint)> onCreate;
+    std::map<std::string, GLuint> programs;  // by #define block
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A fixed-size pool of worker threads for CPU-side generation work (noise volumes, terrain maps).
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned numThreads = 0) {
+        if (numThreads == 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < numThreads; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Shared pool sized to the machine, created on first use
+    static ThreadPool &global() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+    // Queue a job to run on some worker, fire and forget
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push(std::move(job));
+        }
+        wakeup.notify_one();
+    }
+
+    // Calls func(i) for every i in [begin, end) and blocks until all calls returned.
+    // Indices are handed out one at a time so uneven slabs still balance across workers;
+    // the calling thread takes part too, so this is safe to call from inside a pool job.
+    void parallelFor(int begin, int end, const std::function<void(int)> &func) {
+        if (begin >= end) return;
+
+        std::atomic<int> next{begin};
+        std::atomic<int> running{0};
+        std::mutex doneMutex;
+        std::condition_variable done;
+
+        auto drain = [&] {
+            for (int i = next++; i < end; i = next++)
+                func(i);
+        };
+
+        int numHelpers = std::min<int>(size(), end - begin - 1);
+        running = numHelpers;
+        for (int h = 0; h < numHelpers; h++) {
+            submit([&] {
+                drain();
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--running == 0)
+                    done.notify_one();
+            });
+        }
+        drain();
+
+        // Help out with queued jobs while the helpers finish, so nested calls cannot starve the pool
+        while (running > 0) {
+            if (runPendingJob())
+                continue;
+            std::unique_lock<std::mutex> lock(doneMutex);
+            done.wait_for(lock, std::chrono::milliseconds(1), [&] { return running == 0; });
+        }
+        // The last helper may still hold doneMutex right after its decrement
+        std::lock_guard<std::mutex> lock(doneMutex);
+    }
+
+private:
+    bool runPendingJob() {
+        std::function<void()> job;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (jobs.empty())
+                return false;
+            job = std::move(jobs.front());
+            jobs.pop();
+        }
+        job();
+        return true;
+    }
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+};